@@ -240,13 +240,10 @@ void set_call_received_callback(InviteReceivedCb callback)
 
 void override_soundcards()
 {
-  ylsysfs_model model;
   int card;
   char pcm_name[15];
   char *ringer;
   
-  model = ylsysfs_get_model();
-
   if (lpstates_data.sndcard != NULL)
     ms_snd_card_destroy(lpstates_data.sndcard);
   
@@ -276,7 +273,7 @@ void override_soundcards()
            linphone_core_get_playback_device(&(lpstates_data.core_state)));
   }
 
-  if (!ringer && ((model == YL_MODEL_P1K) || (model == YL_MODEL_P1KH))) {
+  if (!ringer && yldisp_has_ringtone()) {
     /* we use the ringer on the handset */
     linphone_core_set_ring(&(lpstates_data.core_state), "/dev/null");
   }
@@ -288,13 +285,16 @@ void lpstates_submit_command(lpstates_command_t command, char *arg)
 {
   char *cp = arg;
   int level;
+  int timer_id;
   
   /*printf("command %d with arg '%s'\n", command, arg);*/
   
   switch (command) {
     case LPCOMMAND_STARTUP:
-      yp_ml_schedule_periodic_timer(LPCONTROL_TIMER_ID, 200, 1,
-                                    lpcontrol_timer_callback, &lpstates_data);
+      timer_id = yp_ml_schedule_periodic_timer(LPCONTROL_TIMER_ID, 200, 1,
+                                               lpcontrol_timer_callback,
+                                               &lpstates_data);
+      yp_ml_set_timer_slack(timer_id, 100);
       linphone_core_init(&(lpstates_data.core_state), lpstates_data.vtable,
                          lpstates_data.configfile_name, &lpstates_data);
       setLinphoneCore(&(lpstates_data.core_state));
@@ -32,6 +32,8 @@
 #include <signal.h>
 #include "ylsysfs.h"
 #include "yldisp.h"
+#include "ylringtone.h"
+#include "ylsim.h"
 #include "lpcontrol.h"
 #include "ylcontrol.h"
 #include "ypconfig.h"
@@ -44,19 +46,25 @@
 
 #define CONFIG_FILE ".yeaphonerc"
 
+#define YEAPHONE_SIGNAL_ID  30
+
 char *mycode = "43";   /* default to Austria ;) */
-int ylcontrol_started = 0;
+int terminating = 0;
 
 
 struct cmdline_options {
   char *uniq;
   int wait_for_device;
   int verbose;
+  int simulate;
+  char *sim_model;
 };
 static struct cmdline_options cmdline_opts = {
   uniq: NULL,
   wait_for_device: 0,
-  verbose: 0
+  verbose: 0,
+  simulate: 0,
+  sim_model: NULL
 };
 
 void parse_args(int argc, char **argv) {
@@ -66,6 +74,7 @@ void parse_args(int argc, char **argv) {
     {"help", 0, 0, 'h'},
     {"id", 1, 0, 0},
     {"wait", 2, 0, 1},
+    {"simulate", 2, 0, 2},
     {"verbose", 0, 0, 'v'},
     {0, 0, 0, 0}
   };
@@ -78,6 +87,10 @@ void parse_args(int argc, char **argv) {
     case 1: 
       cmdline_opts.wait_for_device = (optarg) ? atoi(optarg) : 10;
       break;
+    case 2:
+      cmdline_opts.simulate = 1;
+      cmdline_opts.sim_model = (optarg) ? strdup(optarg) : NULL;
+      break;
     case 'w': 
       cmdline_opts.wait_for_device = 10;
       break;
@@ -89,6 +102,8 @@ void parse_args(int argc, char **argv) {
       printf("\t--id=<id>\tAttach to the device with an ID <id>.\n");
       printf("\t--wait=[<sec>]\tCheck for the handset every <sec> seconds.\n");
       printf("\t-w\t\tCheck for the handset every 10 seconds.\n");
+      printf("\t--simulate=[<model>]\tUse a simulated handset (P1K by default),\n"
+             "\t\t\tits keys are read from the terminal.\n");
       printf("\t--verbose|-v\tShow debug messages.\n");
       printf("\t--help|-h\tPrint this help message.\n");
       exit(1);
@@ -119,35 +134,127 @@ void read_config() {
 }
 
 
-void terminate(int signum)
+void report_wakeups() {
+  struct yp_ml_stats stats;
+  struct yldisp_stats disp;
+
+  yp_ml_get_stats(&stats);
+  if (stats.run_time > 0) {
+    printf("mainloop: %llu wakeups in %llu s (%.2f/s)\n",
+           stats.wakeups, stats.run_time / 1000,
+           stats.wakeups * 1000.0 / stats.run_time);
+  }
+  yldisp_get_stats(&disp);
+  if (disp.flushes > 0) {
+    printf("display: %lu updates in %lu flushes, %lu writes "
+           "(%.2f saved per flush)\n",
+           disp.updates, disp.flushes, disp.writes,
+           ((double) disp.updates - disp.writes) / disp.flushes);
+  }
+  if ((disp.idle_ms >= 1000) && (stats.run_time > disp.idle_ms)) {
+    printf("display idle: %llu wakeups in %lu s (%.1f/min, %.1f/min "
+           "otherwise)\n", disp.idle_wakeups, disp.idle_ms / 1000,
+           disp.idle_wakeups * 60000.0 / disp.idle_ms,
+           (stats.wakeups - disp.idle_wakeups) * 60000.0 /
+           (stats.run_time - disp.idle_ms));
+  }
+  if (disp.written > 0) {
+    printf("display queue: %lu written, %lu merged, at most %lu waiting, "
+           "waited %lu/%lu us (avg/max)\n",
+           disp.written, disp.collapsed, disp.queued_max,
+           disp.wait_us / disp.written, disp.wait_max_us);
+  }
+  if (cmdline_opts.simulate) {
+    struct ylsim_stats sim;
+
+    ylsim_get_stats(&sim);
+    if (sim.latencies > 0) {
+      printf("simulator: %lu keys, key to display %lu/%lu/%lu us "
+             "(min/avg/max)\n", sim.keys, sim.latency_min,
+             sim.latency_sum / sim.latencies, sim.latency_max);
+    }
+  }
+}
+
+
+int config_enabled(const char *key) {
+  char *value = ypconfig_get_value(key);
+  
+  return (value && (!strcmp(value, "yes") || !strcmp(value, "1")));
+}
+
+
+void apply_mainloop_config() {
+  char *value;
+
+  yp_ml_set_coalescing(config_enabled("timer-coalescing"));
+  yp_ml_set_profiling(config_enabled("mainloop-profiling"));
+  yp_ml_set_stats_file(ypconfig_get_value("mainloop-stats-file"));
+  yldisp_set_writer_thread(config_enabled("display-writer-thread"));
+  value = ypconfig_get_value("display-idle-timeout");
+  yldisp_set_idle_timeout((value) ? atoi(value) : 0);
+}
+
+
+/* The signal callbacks are called by the mainloop, not in signal context */
+
+void terminate_callback(int id, int group, void *private_data)
 {
-  if (ylcontrol_started) {
+  if (!terminating) {
+    terminating = 1;
     puts("\ngraceful exit requested...");
     stop_ylcontrol();
   }
-  else {
-    signal(signum, SIG_DFL);
-    raise(signum);
+}
+
+
+void reload_callback(int id, int group, void *private_data)
+{
+  puts("reloading configuration...");
+  /* numbers which were just stored must not be lost */
+  ylcontrol_flush_config();
+  if (ypconfig_read(NULL) >= 0) {
+    apply_mainloop_config();
+    ylringtone_preload();
   }
 }
 
 
+void dump_stats_callback(int id, int group, void *private_data)
+{
+  yp_ml_request_stats_dump();
+}
+
+
+void watch_signals() {
+  yp_ml_watch_signal(YEAPHONE_SIGNAL_ID, SIGTERM, terminate_callback, NULL);
+  yp_ml_watch_signal(YEAPHONE_SIGNAL_ID, SIGINT, terminate_callback, NULL);
+  yp_ml_watch_signal(YEAPHONE_SIGNAL_ID, SIGHUP, reload_callback, NULL);
+  yp_ml_watch_signal(YEAPHONE_SIGNAL_ID, SIGUSR1, dump_stats_callback, NULL);
+}
+
+
 int main(int argc, char **argv) {
   int ret;
 
   parse_args(argc, argv);
   read_config();
-  
-  /* graceful exit handler */
-  signal(SIGTERM, &terminate);
-  signal(SIGINT, &terminate);
+  ylringtone_preload();
   
   yp_ml_init();
+  apply_mainloop_config();
   init_ylcontrol(mycode);
-  ylcontrol_started = 0;
+
+  if (cmdline_opts.simulate &&
+      ((ylsim_start(cmdline_opts.sim_model) < 0) ||
+       (ylsim_watch_terminal() < 0)))
+    return 1;
 
   while (1) {
-    ret = ylsysfs_find_device(cmdline_opts.uniq);
+    if (cmdline_opts.simulate)
+      ret = 0;
+    else
+      ret = ylsysfs_find_device(cmdline_opts.uniq);
     if (ret == -ENOENT) {
       if (cmdline_opts.wait_for_device) {
         printf("Please connect your handset, waiting...\n");
@@ -163,17 +270,27 @@ int main(int argc, char **argv) {
       break;
     }
 
+    /* handle signals in the mainloop while it runs (the default action
+       applies otherwise), before liblinphone starts any threads */
+    watch_signals();
     start_lpcontrol(1, NULL);
     start_ylcontrol();
-    ylcontrol_started = 1;
 
-    if (yp_ml_run() != 0)
+    ret = yp_ml_run();
+    yp_ml_remove_event(-1, YEAPHONE_SIGNAL_ID);
+    if (cmdline_opts.verbose)
+      report_wakeups();
+    if ((ret != 0) || terminating || cmdline_opts.simulate)
       break;
 
-    ylcontrol_started = 0;
     yldisp_clear();
   }
 
+  /* the mainloop may not have run (long enough) to write changes */
+  ylcontrol_flush_config();
+  yldisp_set_writer_thread(0);
+  if (cmdline_opts.simulate)
+    ylsim_stop();
   return 0;
 }
 
@@ -32,6 +32,7 @@
 #include <ctype.h>
 #include <assert.h>
 #include <linux/input.h>
+#include <sys/stat.h>
 
 #include <linphone/linphonecore.h>
 #include <osipparser2/osip_message.h>
@@ -280,6 +281,26 @@ static int get_custom_minring(const char *callernum)
 
 /***********************************/
 
+static void write_config_callback(int id, int group, void *private_data) {
+  ypconfig_write(NULL);
+}
+
+/* Writing the configuration file is slow, so it is done when the phone
+ * has nothing else to do. A single pending write covers all changes. */
+static void write_config_deferred() {
+  if (yp_ml_count_events(-1, YLCONTROL_CONFIG_ID) == 0)
+    yp_ml_defer(YLCONTROL_CONFIG_ID, 2000, write_config_callback, NULL);
+}
+
+/* Writes a deferred change of the configuration file right away, e.g.
+ * before yeaphone exits or reads the file again. */
+void ylcontrol_flush_config() {
+  if (yp_ml_remove_event(-1, YLCONTROL_CONFIG_ID) > 0)
+    ypconfig_write(NULL);
+}
+
+/***********************************/
+
 void handle_key(ylcontrol_data_t *ylc_ptr, int code, int value) {
   char c;
   gstate_t lpstate_power;
@@ -296,6 +317,8 @@ void handle_key(ylcontrol_data_t *ylc_ptr, int code, int value) {
   lpstate_reg = linphone_core_get_state(ylc_ptr->lc, GSTATE_GROUP_REG);
 #endif
   
+  yldisp_activity();
+
   /* preprocess the key codes */
   switch (code) {
     case 42:              /* left shift */
@@ -361,7 +384,7 @@ void handle_key(ylcontrol_data_t *ylc_ptr, int code, int value) {
               key[3] = c;
               ypconfig_set_pair(key, (len) ? ylc_ptr->dialnum : ylc_ptr->dialback);
               free(key);
-              ypconfig_write(NULL);
+              write_config_deferred();
               ylc_ptr->prep_store = 0;
               set_yldisp_store_type(YL_STORE_NONE);
             }
@@ -597,7 +620,6 @@ void lps_callback(struct _LinphoneCore *lc,
   gstate_t lpstate_power;
   gstate_t lpstate_call;
   gstate_t lpstate_reg;
-  ylsysfs_model model;
   
   /* make sure this is the same thread as our main loop! */
   assert(yp_ml_same_thread());
@@ -612,21 +634,21 @@ void lps_callback(struct _LinphoneCore *lc,
   lpstate_reg = linphone_core_get_state(lc, GSTATE_GROUP_REG);
 #endif
   
-  model = ylsysfs_get_model();
-  
+  /* calls and registration changes end the idle mode */
+  yldisp_activity();
+
   switch (gstate->new_state) {
     case GSTATE_POWER_OFF:
-      yldisp_hide_all();
-      if (ylcontrol_data.hard_shutdown)
+      if (ylcontrol_data.hard_shutdown) {
+        yldisp_hide_all();
         yp_ml_stop();
+      }
       else
-        set_yldisp_text("   - off -  ");
+        yldisp_set_scene(YLDISP_SCENE_OFF, 0);
       break;
       
     case GSTATE_POWER_STARTUP:
-      yldisp_show_date();
-      set_yldisp_text("- startup - ");
-      yldisp_led_blink(150, 150);
+      yldisp_set_scene(YLDISP_SCENE_STARTUP, 0);
       break;
       
     case GSTATE_POWER_ON:
@@ -646,14 +668,12 @@ void lps_callback(struct _LinphoneCore *lc,
         if (ylcontrol_data.dialnum[0] == '\0') {
           set_yldisp_text("-reg failed-");
         }
-        yldisp_led_blink(150, 150);
+        yldisp_set_scene(YLDISP_SCENE_REG_FAILED, 0);
       }
       break;
       
     case GSTATE_POWER_SHUTDOWN:
-      yldisp_hide_all();
-      yldisp_led_blink(150, 150);
-      set_yldisp_text("- shutdown -");
+      yldisp_set_scene(YLDISP_SCENE_SHUTDOWN, 0);
       break;
       
     case GSTATE_REG_OK:
@@ -664,7 +684,7 @@ void lps_callback(struct _LinphoneCore *lc,
           display_dialnum((ylcontrol_data.dialback[0]) ?
                      ylcontrol_data.dialback : ylcontrol_data.default_display);
         }
-        yldisp_led_on();
+        yldisp_set_scene(YLDISP_SCENE_IDLE, 0);
       }
       break;
       
@@ -674,10 +694,10 @@ void lps_callback(struct _LinphoneCore *lc,
       if (lpstate_reg == GSTATE_REG_FAILED) {
         set_yldisp_text("-reg failed-");
         ylcontrol_data.dialnum[0] = '\0';
-        yldisp_led_blink(150, 150);
+        yldisp_set_scene(YLDISP_SCENE_REG_FAILED, 0);
       }
       else if (lpstate_reg == GSTATE_REG_OK) {
-        yldisp_led_on();
+        yldisp_set_scene(YLDISP_SCENE_IDLE, 0);
       }
       break;
       
@@ -706,58 +726,35 @@ void lps_callback(struct _LinphoneCore *lc,
       }
       ylcontrol_data.dialnum[0] = '\0';
       
-      set_yldisp_call_type(YL_CALL_IN);
-      yldisp_led_blink(300, 300);
-      set_yldisp_backlight(1);
-
-      if (model == YL_MODEL_P1K) {
-        /* ringing seems to block displaying line 3,
-         * so we have to wait for about 170ms.
-         * This seems to be a limitation of the hardware */
-        usleep(170000);
-      }
-      set_yldisp_ringer(YL_RINGER_ON, get_custom_minring(ylcontrol_data.callernum));
+      yldisp_set_scene(YLDISP_SCENE_RINGING,
+                       get_custom_minring(ylcontrol_data.callernum));
       break;
       
     case GSTATE_CALL_IN_CONNECTED:
-      set_yldisp_ringer(YL_RINGER_OFF, 0);
-      /* start timer */
-      yldisp_start_counter();
-      yldisp_led_blink(1000, 100);
+      /* stops the ringer and starts the timer */
+      yldisp_set_scene(YLDISP_SCENE_IN_CALL, 0);
       break;
       
     case GSTATE_CALL_OUT_INVITE:
-      set_yldisp_call_type(YL_CALL_OUT);
-      yldisp_led_blink(300, 300);
-      yldisp_show_counter();
+      yldisp_set_scene(YLDISP_SCENE_CALLING, 0);
       break;
       
     case GSTATE_CALL_OUT_CONNECTED:
       /* Unfortunately this state is sent already if early media is
        * available. If the remote party picks up it is sent again, so
        * the duration of the call is reset and displayed correctly. */
-      yldisp_start_counter();
-      yldisp_led_blink(1000, 100);
+      yldisp_set_scene(YLDISP_SCENE_IN_CALL, 0);
       break;
       
     case GSTATE_CALL_END:
-      set_yldisp_ringer(YL_RINGER_OFF_DELAYED, 0);
-      set_yldisp_call_type(YL_CALL_NONE);
       display_dialnum((ylcontrol_data.dialback[0]) ?
                       ylcontrol_data.dialback : ylcontrol_data.default_display);
-      yldisp_show_date();
-      yldisp_led_on();
-      set_yldisp_backlight(0);
+      yldisp_set_scene(YLDISP_SCENE_CALL_END, 0);
       break;
       
     case GSTATE_CALL_ERROR:
-      set_yldisp_ringer(YL_RINGER_OFF, 0);
       ylcontrol_data.dialback[0] = '\0';
-      set_yldisp_call_type(YL_CALL_NONE);
-      set_yldisp_text(" - error -  ");
-      yldisp_show_date();
-      yldisp_led_on();
-      set_yldisp_backlight(0);
+      yldisp_set_scene(YLDISP_SCENE_ERROR, 0);
       break;
       
     default:
@@ -794,6 +791,7 @@ void ylcontrol_keylong_callback(int id, int group, void *private_data) {
 void ylcontrol_io_callback(int id, int group, void *private_data) {
   ylcontrol_data_t *ylc_ptr = private_data;
   int bytes;
+  int timer_id;
   struct input_event event;
 
   bytes = read(ylc_ptr->evfd, &event, sizeof(struct input_event));
@@ -817,8 +815,10 @@ void ylcontrol_io_callback(int id, int group, void *private_data) {
     
     if (ylcontrol_data.pressed >= 0) {
       /* wait for key being pressed long (1 second) */
-      yp_ml_schedule_timer(YLCONTROL_KEYLONG_ID, 1000,
-                           ylcontrol_keylong_callback, private_data);
+      timer_id = yp_ml_schedule_timer(YLCONTROL_KEYLONG_ID, 1000,
+                                      ylcontrol_keylong_callback, private_data);
+      yp_ml_set_timer_slack(timer_id, 50);
+      yp_ml_set_priority(timer_id, YP_ML_PRIO_INPUT);
     }
   }
 }
@@ -853,7 +853,7 @@ void init_ylcontrol(char *countrycode) {
 
   if (modified) {
     /* write back modified configuration */
-    ypconfig_write(NULL);
+    write_config_deferred();
   }
 }
 
@@ -861,6 +861,8 @@ void init_ylcontrol(char *countrycode) {
 
 void start_ylcontrol() {
   const char *path_event;
+  struct stat event_stat;
+  int io_id;
   
   ylcontrol_data.hard_shutdown = 0;
   ylcontrol_data.linphone_2_1_1_bug = 0;
@@ -875,14 +877,20 @@ void start_ylcontrol() {
   }
   
   /* grab the event device to prevent it from propagating
-     its events to the regular keyboard driver            */
-  if (ioctl(ylcontrol_data.evfd, EVIOCGRAB, (void *)1)) {
+     its events to the regular keyboard driver (a simulated
+     handset uses a FIFO instead)                          */
+  if (!fstat(ylcontrol_data.evfd, &event_stat) &&
+      S_ISCHR(event_stat.st_mode) &&
+      ioctl(ylcontrol_data.evfd, EVIOCGRAB, (void *)1)) {
     perror("EVIOCGRAB");
     abort();
   }
   
-  yp_ml_poll_io(YLCONTROL_IO_ID, ylcontrol_data.evfd,
-                ylcontrol_io_callback, &ylcontrol_data);
+  io_id = yp_ml_poll_io(YLCONTROL_IO_ID, ylcontrol_data.evfd,
+                        ylcontrol_io_callback, &ylcontrol_data);
+  /* key presses go before anything else due in the same iteration */
+  if (io_id >= 0)
+    yp_ml_set_priority(io_id, YP_ML_PRIO_INPUT);
 }
 
 /*************************************/
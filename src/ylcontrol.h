@@ -29,6 +29,7 @@
 
 #define YLCONTROL_IO_ID       10
 #define YLCONTROL_KEYLONG_ID  11
+#define YLCONTROL_CONFIG_ID   12
 
 void init_ylcontrol();
 void start_ylcontrol();
@@ -36,5 +37,7 @@ void start_ylcontrol();
 void wait_ylcontrol();
 void stop_ylcontrol();
 
+void ylcontrol_flush_config();
+
 
 #endif
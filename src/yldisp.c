@@ -31,14 +31,23 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <time.h>
+#include <sys/time.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <errno.h>
+#include "config.h"
 #include "yldisp.h"
 #include "ylsysfs.h"
+#include "ylringtone.h"
 #include "ypmainloop.h"
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#endif
+
 #ifdef DMALLOC
 #include <dmalloc.h>
 #endif
@@ -48,79 +57,974 @@
 #define YLDISP_BLINK_ID     20
 #define YLDISP_DATETIME_ID  21
 #define YLDISP_MINRING_ID   22
+#define YLDISP_FLUSH_ID     23
+#define YLDISP_QUEUE_ID     24
+
+/* interval of the date while the phone is idle */
+#define YLDISP_IDLE_TICK    60000
+
+#define YLDISP_LINES        3
+#define YLDISP_LINE_MAX     17
+
+static const char *line_names[YLDISP_LINES] = { "line1", "line2", "line3" };
+static const int line_len[YLDISP_LINES] = { 17, 9, 12 };
+
+typedef enum { YLDISP_ICON_LED,
+               YLDISP_ICON_RINGTONE,
+               YLDISP_ICON_SPEAKER,
+               YLDISP_ICON_PSTN,
+               YLDISP_ICON_DIALTONE,
+               YLDISP_ICON_BACKLIGHT,
+               YLDISP_ICONS } yldisp_icon_t;
+
+static const char *icon_names[YLDISP_ICONS] = {
+  "LED", "RINGTONE", "SPEAKER", "PSTN", "DIALTONE", "BACKLIGHT"
+};
+
+/* state of an icon in the shadow, unknown until it is set first */
+enum { ICON_UNKNOWN = 0, ICON_HIDDEN, ICON_SHOWN };
+
+#define ICON(name)  (1 << YLDISP_ICON_##name)
+
+/* hardware limits in [ms] */
+#define RINGER_STOP_DELAY    10   /* until a stopped buzzer can be used */
+
+/* the parts of the display which are set separately */
+typedef enum { YLDISP_SEG_CLOCK,        /* date or duration, "MM.DD.hh.mm" */
+               YLDISP_SEG_SECONDS,      /* a blank and "ss" */
+               YLDISP_SEG_CALL_IN,
+               YLDISP_SEG_CALL_OUT,
+               YLDISP_SEG_STORE,
+               YLDISP_SEG_WEEKDAY,      /* a position per day from Sunday */
+               YLDISP_SEG_TEXT,
+               YLDISP_SEGMENTS } yldisp_seg_t;
+
+typedef struct yldisp_segment yldisp_segment;
+struct yldisp_segment {
+  int line;
+  int pos;
+  int len;                      /* 0 if the handset does not have it */
+};
+
+/* What a model of handset can show, adding a model means adding an entry
+ * to 'layouts' below. */
+typedef struct yldisp_layout yldisp_layout;
+struct yldisp_layout {
+  const yldisp_segment *segments;
+  unsigned int icons;           /* mask of the icons it has */
+  yldisp_icon_t ringer;         /* the icon which starts the buzzer */
+  int ringtone_format;          /* a ylringtone_format, -1 if fixed */
+  int line3_delay;              /* [ms] line 3 must be written before
+                                   ringing, as the buzzer blocks it */
+};
+
+static const yldisp_segment lcd_segments[YLDISP_SEGMENTS] = {
+  { 0,  0, 11 },                /* CLOCK */
+  { 0, 14,  3 },                /* SECONDS */
+  { 0, 11,  1 },                /* CALL_IN */
+  { 0, 12,  1 },                /* CALL_OUT */
+  { 0, 13,  1 },                /* STORE */
+  { 1,  2,  7 },                /* WEEKDAY */
+  { 2,  0, 12 }                 /* TEXT */
+};
+
+/* indexed by ylsysfs_model */
+static const yldisp_layout layouts[] = {
+  {                             /* YL_MODEL_UNKNOWN */
+    segments: lcd_segments,
+    icons: ICON(LED) | ICON(RINGTONE),
+    ringer: YLDISP_ICON_RINGTONE,
+    ringtone_format: -1,
+    line3_delay: 0
+  },
+  {                             /* YL_MODEL_P1K */
+    segments: lcd_segments,
+    icons: ICON(LED) | ICON(RINGTONE),
+    ringer: YLDISP_ICON_RINGTONE,
+    ringtone_format: YLRINGTONE_G1,
+    line3_delay: 170
+  },
+  {                             /* YL_MODEL_P4K */
+    segments: lcd_segments,
+    icons: ICON(LED) | ICON(SPEAKER) | ICON(DIALTONE) | ICON(BACKLIGHT),
+    ringer: YLDISP_ICON_SPEAKER,
+    ringtone_format: -1,
+    line3_delay: 0
+  },
+  {                             /* YL_MODEL_B2K */
+    segments: lcd_segments,
+    icons: ICON(LED) | ICON(RINGTONE) | ICON(PSTN) | ICON(DIALTONE),
+    ringer: YLDISP_ICON_RINGTONE,
+    ringtone_format: -1,
+    line3_delay: 0
+  },
+  {                             /* YL_MODEL_B3G */
+    segments: lcd_segments,
+    icons: ICON(LED) | ICON(RINGTONE) | ICON(PSTN) | ICON(DIALTONE),
+    ringer: YLDISP_ICON_RINGTONE,
+    ringtone_format: -1,
+    line3_delay: 0
+  },
+  {                             /* YL_MODEL_P1KH */
+    segments: lcd_segments,
+    icons: ICON(LED) | ICON(RINGTONE),
+    ringer: YLDISP_ICON_RINGTONE,
+    ringtone_format: YLRINGTONE_G2,
+    line3_delay: 0
+  }
+};
+
+/* What the phone shows in each state, independent of the model. A field
+ * left out (0) keeps what is shown. */
+typedef enum { SCENE_KEEP = 0, SCENE_OFF, SCENE_ON } scene_switch_t;
+typedef enum { SCENE_CLOCK_KEEP = 0,
+               SCENE_CLOCK_DATE,
+               SCENE_CLOCK_COUNTER,       /* starts counting */
+               SCENE_CLOCK_COUNTER_SHOW   /* shows 0 until it starts */
+} scene_clock_t;
+
+typedef struct yldisp_scene_desc yldisp_scene_desc;
+struct yldisp_scene_desc {
+  int hide_all;                 /* clears the lines and stops the clock */
+  const char *text;
+  int call_type;                /* a yl_call_type_t + 1 */
+  int ringer;                   /* a yl_ringer_state_t + 1 */
+  unsigned int led_on;          /* as for yldisp_led_blink(), both 0 */
+  unsigned int led_off;         /* keeps the LED */
+  scene_switch_t backlight;
+  scene_switch_t dial_tone;
+  scene_switch_t pstn;
+  scene_clock_t clock;
+};
+
+#define SCENE_CALL(type)    ((type) + 1)
+#define SCENE_RINGER(rs)    ((rs) + 1)
+
+/* indexed by yldisp_scene_t */
+static const yldisp_scene_desc scene_descs[YLDISP_SCENES] = {
+  {                             /* YLDISP_SCENE_NONE */
+  },
+  {                             /* YLDISP_SCENE_OFF */
+    hide_all: 1,
+    text: "   - off -  ",
+    ringer: SCENE_RINGER(YL_RINGER_OFF),
+    led_on: 0, led_off: 1,
+    backlight: SCENE_OFF,
+    dial_tone: SCENE_OFF,
+    pstn: SCENE_ON
+  },
+  {                             /* YLDISP_SCENE_STARTUP */
+    text: "- startup - ",
+    led_on: 150, led_off: 150,
+    clock: SCENE_CLOCK_DATE
+  },
+  {                             /* YLDISP_SCENE_SHUTDOWN */
+    hide_all: 1,
+    text: "- shutdown -",
+    ringer: SCENE_RINGER(YL_RINGER_OFF),
+    led_on: 150, led_off: 150,
+    backlight: SCENE_OFF,
+    dial_tone: SCENE_OFF,
+    pstn: SCENE_ON
+  },
+  {                             /* YLDISP_SCENE_REG_FAILED */
+    led_on: 150, led_off: 150
+  },
+  {                             /* YLDISP_SCENE_IDLE */
+    led_on: 1, led_off: 0
+  },
+  {                             /* YLDISP_SCENE_RINGING */
+    call_type: SCENE_CALL(YL_CALL_IN),
+    ringer: SCENE_RINGER(YL_RINGER_ON),
+    led_on: 300, led_off: 300,
+    backlight: SCENE_ON
+  },
+  {                             /* YLDISP_SCENE_CALLING */
+    call_type: SCENE_CALL(YL_CALL_OUT),
+    led_on: 300, led_off: 300,
+    clock: SCENE_CLOCK_COUNTER_SHOW
+  },
+  {                             /* YLDISP_SCENE_IN_CALL */
+    ringer: SCENE_RINGER(YL_RINGER_OFF),
+    led_on: 1000, led_off: 100,
+    clock: SCENE_CLOCK_COUNTER
+  },
+  {                             /* YLDISP_SCENE_CALL_END */
+    call_type: SCENE_CALL(YL_CALL_NONE),
+    ringer: SCENE_RINGER(YL_RINGER_OFF_DELAYED),
+    led_on: 1, led_off: 0,
+    backlight: SCENE_OFF,
+    clock: SCENE_CLOCK_DATE
+  },
+  {                             /* YLDISP_SCENE_ERROR */
+    text: " - error -  ",
+    call_type: SCENE_CALL(YL_CALL_NONE),
+    ringer: SCENE_RINGER(YL_RINGER_OFF),
+    led_on: 1, led_off: 0,
+    backlight: SCENE_OFF,
+    clock: SCENE_CLOCK_DATE
+  }
+};
+
+typedef enum { YLDISP_CMD_LINE,
+               YLDISP_CMD_ICON,
+               YLDISP_CMD_RINGTONE } yldisp_cmd_type_t;
+
+/* a write to the handset waiting in the command queue */
+typedef struct yldisp_cmd yldisp_cmd;
+struct yldisp_cmd {
+  yldisp_cmd *next;
+  yldisp_cmd_type_t type;
+  int index;                    /* of the line or icon */
+  int show;
+  int line3_delay;              /* of the layout when it was queued */
+  struct timeval queued;
+  int len;
+  char data[RINGTONE_MAXLEN];
+};
+
+#ifdef HAVE_PTHREAD_H
+/* Writes to the handset may block for a few ms each. The optional writer
+ * thread takes the commands from a ring which only the mainloop fills and
+ * only the writer empties, so neither has to lock. */
+#define WRITER_RING_LEN  32
+
+typedef struct yldisp_writer yldisp_writer;
+struct yldisp_writer {
+  pthread_t thread;
+  sem_t ready;                  /* commands in the ring */
+  yldisp_cmd *ring[WRITER_RING_LEN];
+  volatile unsigned int head;   /* advanced by the writer */
+  volatile unsigned int tail;   /* advanced by the mainloop */
+  volatile int stop;
+  volatile int waiting;         /* the mainloop waits for space */
+  pthread_cond_t progress;      /* signalled with hw_lock after a write */
+};
+
+static yldisp_writer writer = {
+  progress: PTHREAD_COND_INITIALIZER
+};
+#endif
+
+/* What the thread writing to the handset knows about it: when the last
+ * writes were done, for the holds of the hardware, and the statistics of
+ * the queue. With a writer thread it is only used with 'hw_lock' held. */
+typedef struct yldisp_hw yldisp_hw;
+struct yldisp_hw {
+  struct timeval line_written[YLDISP_LINES];
+  struct timeval icon_hidden[YLDISP_ICONS];
+  unsigned long written;
+  unsigned long wait_us;
+  unsigned long wait_max_us;
+};
+
+static yldisp_hw hw;
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t hw_lock = PTHREAD_MUTEX_INITIALIZER;
+#define HW_LOCK()    pthread_mutex_lock(&hw_lock)
+#define HW_UNLOCK()  pthread_mutex_unlock(&hw_lock)
+#else
+#define HW_LOCK()
+#define HW_UNLOCK()
+#endif
+
+typedef enum { YLDISP_DT_DATE,
+               YLDISP_DT_COUNTER,
+               YLDISP_DT_WAIT_DATE } yldisp_dt_mode_t;
 
 typedef struct yldisp_data yldisp_data;
 struct yldisp_data {
   unsigned int blink_on_time;
   unsigned int blink_off_time;
-  int blink_reschedule;
+  int blink_id;
+  int led_lit;
   
   time_t counter_base;
   int wait_date_after_count;
+  int wait_date_ticks;
+  int datetime_id;
+  yldisp_dt_mode_t datetime_mode;
+
+  /* in idle mode the date is shown without seconds */
+  int idle_timeout;             /* [s], 0 for never */
+  int idle;
+  time_t last_activity;         /* monotonic [s] */
+  struct timeval idle_since;
+  unsigned long long idle_since_wakeups;
   
   int ring_off_delayed;
+
+  /* of the current handset, looked up when it is first needed */
+  const yldisp_layout *layout;
+  
+  /* Shadow of the display. 'line' and 'icon' are the wanted state,
+   * 'line_hw' and 'icon_hw' what was written to the handset. A '\0' in
+   * a line is a position which is not set (or not known) yet. */
+  char line[YLDISP_LINES][YLDISP_LINE_MAX + 1];
+  char line_hw[YLDISP_LINES][YLDISP_LINE_MAX + 1];
+  char icon[YLDISP_ICONS];
+  char icon_hw[YLDISP_ICONS];
+  int flush_pending;
+  unsigned long pending_updates;
+  struct yldisp_stats stats;
+
+  /* writes to the handset in the order they are issued, a command may
+   * have to wait for an earlier write to take effect */
+  yldisp_cmd *queue_head;
+  yldisp_cmd *queue_tail;
+  int queue_len;
+  int queue_timer;
+  int writer_running;
+
+  /* the ringtone the handset holds, if ringtone_known is set */
+  int ringtone_known;
+  unsigned int ringtone_hash;
+  int ringtone_len;
+  unsigned char ringtone_volume;
+
+  /* the steady icons of each scene on the current handset, built with
+   * its layout, ICON_UNKNOWN keeps an icon */
+  char scene_icon[YLDISP_SCENES][YLDISP_ICONS];
+  yldisp_scene_t scene;
 };
 
-static yldisp_data module_data;
+static yldisp_data module_data = {
+  blink_id: -1,
+  datetime_id: -1
+};
 
 /*****************************************************************/
 
+static void queue_run(int force);
+static void datetime_stop();
+static void scenes_build(const yldisp_layout *layout);
+
 void yldisp_clear()
 {
   yp_ml_remove_event(-1, YLDISP_BLINK_ID);
-  yp_ml_remove_event(-1, YLDISP_DATETIME_ID);
+  module_data.blink_id = -1;
+  datetime_stop();
   
   /* more to come, eg. free */
   
   yldisp_hide_all();
+  yldisp_flush();
+
+  /* the mainloop has stopped, so do not wait for the hardware */
+  yp_ml_remove_event(-1, YLDISP_QUEUE_ID);
+  module_data.queue_timer = 0;
+  queue_run(1);
+#ifdef HAVE_PTHREAD_H
+  if (module_data.writer_running) {
+    HW_LOCK();
+    while (writer.head != writer.tail)
+      pthread_cond_wait(&writer.progress, &hw_lock);
+    HW_UNLOCK();
+  }
+#endif
+
+  /* the next handset may show anything */
+  memset(module_data.line_hw, 0, sizeof(module_data.line_hw));
+  memset(module_data.icon_hw, 0, sizeof(module_data.icon_hw));
+  module_data.ringtone_known = 0;
+  module_data.layout = NULL;
+  module_data.scene = YLDISP_SCENE_NONE;
+}
+
+static const yldisp_layout *get_layout()
+{
+  ylsysfs_model model;
+
+  if (!module_data.layout) {
+    model = ylsysfs_get_model();
+    if (model >= sizeof(layouts) / sizeof(layouts[0]))
+      model = YL_MODEL_UNKNOWN;
+    module_data.layout = &layouts[model];
+    scenes_build(module_data.layout);
+  }
+  return module_data.layout;
 }
 
 /*****************************************************************/
 
-static void led_on_callback(int id, int group, void *private_data) {
-  (void) private_data;
-  
-  if (module_data.blink_reschedule) {
-    module_data.blink_reschedule = 0;
-    yp_ml_schedule_periodic_timer(YLDISP_BLINK_ID,
-                                  module_data.blink_on_time + module_data.blink_off_time,
-                                  0, led_on_callback, NULL);
+static void hold_after(struct timeval *written, int delay,
+                       struct timeval *not_before)
+{
+  struct timeval tv;
+
+  if (!timerisset(written))
+    return;
+  tv.tv_sec = delay / 1000;
+  tv.tv_usec = (delay % 1000) * 1000;
+  timeradd(written, &tv, &tv);
+  if (timercmp(&tv, not_before, >))
+    *not_before = tv;
+}
+
+/* Determines when a command may be written at the earliest because of
+ * the hardware's limits, returns 0 if it need not wait.
+ */
+static int cmd_not_before(yldisp_cmd *cmd, struct timeval *not_before)
+{
+  int ringer = 0;
+
+  timerclear(not_before);
+  HW_LOCK();
+  if ((cmd->type == YLDISP_CMD_ICON) && cmd->show)
+    ringer = (cmd->index == YLDISP_ICON_RINGTONE) ||
+             (cmd->index == YLDISP_ICON_SPEAKER);
+
+  if (ringer || (cmd->type == YLDISP_CMD_RINGTONE)) {
+    /* the buzzer must be off for a moment before it is started again
+     * or gets a new ringtone */
+    hold_after(&hw.icon_hidden[(ringer) ? cmd->index :
+                                        YLDISP_ICON_RINGTONE],
+               RINGER_STOP_DELAY, not_before);
+  }
+  if (ringer && cmd->line3_delay) {
+    /* ringing seems to block displaying line 3 on some handsets, so it
+     * has to be written a while before */
+    hold_after(&hw.line_written[2], cmd->line3_delay, not_before);
+  }
+  HW_UNLOCK();
+  return timerisset(not_before);
+}
+
+static void ringtone_lost_task(void *private_data)
+{
+  module_data.ringtone_known = 0;
+}
+
+/* The mainloop may not run yet (or no more), so yp_ml_same_thread()
+ * cannot tell the writer thread from the mainloop's thread */
+static int in_writer_thread()
+{
+#ifdef HAVE_PTHREAD_H
+  return module_data.writer_running &&
+         pthread_equal(pthread_self(), writer.thread);
+#else
+  return 0;
+#endif
+}
+
+/* Runs in the writer thread if there is one, it only changes 'hw' and
+ * hands anything else to the mainloop */
+static void cmd_write(yldisp_cmd *cmd)
+{
+  struct timeval now, tv;
+  unsigned long wait;
+
+  yp_ml_get_time(&now);
+  switch (cmd->type) {
+    case YLDISP_CMD_LINE:
+      ylsysfs_write_control_file(line_names[cmd->index], cmd->data);
+      HW_LOCK();
+      hw.line_written[cmd->index] = now;
+      HW_UNLOCK();
+      break;
+    case YLDISP_CMD_ICON:
+      ylsysfs_write_control_file((cmd->show) ? "show_icon" : "hide_icon",
+                                 icon_names[cmd->index]);
+      if (!cmd->show) {
+        HW_LOCK();
+        hw.icon_hidden[cmd->index] = now;
+        HW_UNLOCK();
+      }
+      break;
+    case YLDISP_CMD_RINGTONE:
+      if (ylsysfs_write_control_file_buf("ringtone", cmd->data, cmd->len) < 0)
+      {
+        if (in_writer_thread())
+          yp_ml_post(ringtone_lost_task, NULL);
+        else
+          module_data.ringtone_known = 0;
+      }
+      break;
+  }
+
+  yp_ml_get_time(&tv);
+  timersub(&tv, &cmd->queued, &tv);
+  wait = tv.tv_sec * 1000000 + tv.tv_usec;
+  HW_LOCK();
+  hw.written++;
+  hw.wait_us += wait;
+  if (wait > hw.wait_max_us)
+    hw.wait_max_us = wait;
+  HW_UNLOCK();
+}
+
+static yldisp_cmd *queue_pop()
+{
+  yldisp_cmd *cmd = module_data.queue_head;
+
+  module_data.queue_head = cmd->next;
+  if (module_data.queue_head == NULL)
+    module_data.queue_tail = NULL;
+  module_data.queue_len--;
+  return cmd;
+}
+
+/*****************************************************************/
+
+#ifdef HAVE_PTHREAD_H
+
+static void writer_space_task(void *private_data)
+{
+  queue_run(0);
+}
+
+static void *writer_thread(void *arg)
+{
+  yldisp_cmd *cmd;
+  struct timeval now, not_before, tv;
+
+  while (1) {
+    if (sem_wait(&writer.ready) < 0)
+      continue;
+    if (writer.head == writer.tail) {
+      /* every command was posted, this is the request to stop */
+      if (writer.stop)
+        break;
+      continue;
+    }
+    __sync_synchronize();
+    cmd = writer.ring[writer.head % WRITER_RING_LEN];
+
+    /* this thread may simply sleep until the hardware is ready */
+    if (cmd_not_before(cmd, &not_before)) {
+      yp_ml_get_time(&now);
+      if (timercmp(&now, &not_before, <)) {
+        timersub(&not_before, &now, &tv);
+        usleep(tv.tv_sec * 1000000 + tv.tv_usec);
+      }
+    }
+    cmd_write(cmd);
+    free(cmd);
+
+    HW_LOCK();
+    writer.head++;
+    pthread_cond_broadcast(&writer.progress);
+    HW_UNLOCK();
+    if (writer.waiting && __sync_bool_compare_and_swap(&writer.waiting, 1, 0))
+      yp_ml_post(writer_space_task, NULL);
+  }
+  return NULL;
+}
+
+/* Hands the queued commands to the writer. If its ring is full they
+ * stay queued until it has space again, unless 'force' waits for it. */
+static void writer_feed(int force)
+{
+  yldisp_cmd *cmd;
+
+  while (module_data.queue_head) {
+    if (writer.tail - writer.head >= WRITER_RING_LEN) {
+      if (force) {
+        HW_LOCK();
+        while (writer.tail - writer.head >= WRITER_RING_LEN)
+          pthread_cond_wait(&writer.progress, &hw_lock);
+        HW_UNLOCK();
+        continue;
+      }
+      writer.waiting = 1;
+      __sync_synchronize();
+      if (writer.tail - writer.head >= WRITER_RING_LEN)
+        return;
+      writer.waiting = 0;
+    }
+    cmd = queue_pop();
+    writer.ring[writer.tail % WRITER_RING_LEN] = cmd;
+    __sync_synchronize();
+    writer.tail++;
+    sem_post(&writer.ready);
+  }
+}
+
+#endif
+
+int yldisp_set_writer_thread(int enable)
+{
+#ifdef HAVE_PTHREAD_H
+  sigset_t all, old;
+  int res;
+
+  enable = (enable != 0);
+  if (enable == module_data.writer_running)
+    return 0;
+
+  if (enable) {
+    writer.head = writer.tail = 0;
+    writer.stop = writer.waiting = 0;
+    if (sem_init(&writer.ready, 0, 0) < 0) {
+      res = (errno > 0) ? -errno : -1;
+      perror("sem_init");
+      return res;
+    }
+    /* signals are for the mainloop's thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    res = pthread_create(&writer.thread, NULL, writer_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (res) {
+      fprintf(stderr, "pthread_create: %s\n", strerror(res));
+      sem_destroy(&writer.ready);
+      return -res;
+    }
+    module_data.writer_running = 1;
+
+    /* commands waiting for a timer are the writer's now */
+    yp_ml_remove_event(-1, YLDISP_QUEUE_ID);
+    module_data.queue_timer = 0;
+    queue_run(0);
+  }
+  else {
+    writer_feed(1);
+    writer.stop = 1;
+    sem_post(&writer.ready);
+    pthread_join(writer.thread, NULL);
+    sem_destroy(&writer.ready);
+    module_data.writer_running = 0;
+  }
+  return 0;
+#else
+  return (enable) ? -ENOSYS : 0;
+#endif
+}
+
+static void queue_callback(int id, int group, void *private_data)
+{
+  module_data.queue_timer = 0;
+  queue_run(0);
+}
+
+/* Writes the queued commands until one has to wait, a timer continues
+ * once it may be written. 'force' ignores the hardware limits.
+ */
+static void queue_run(int force)
+{
+  yldisp_cmd *cmd;
+  struct timeval now, not_before, tv;
+
+#ifdef HAVE_PTHREAD_H
+  if (module_data.writer_running) {
+    writer_feed(force);
+    return;
+  }
+#endif
+
+  while ((cmd = module_data.queue_head) != NULL) {
+    if (!force && cmd_not_before(cmd, &not_before)) {
+      yp_ml_get_time(&now);
+      if (timercmp(&now, &not_before, <)) {
+        if (!module_data.queue_timer) {
+          /* timers may run a little early */
+          timersub(&not_before, &now, &tv);
+          yp_ml_schedule_timer(YLDISP_QUEUE_ID,
+                               tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000 +
+                               YP_ML_RESOLUTION,
+                               queue_callback, NULL);
+          module_data.queue_timer = 1;
+        }
+        return;
+      }
+    }
+    queue_pop();
+    cmd_write(cmd);
+    free(cmd);
+  }
+}
+
+/* Merges a write into a queued one to the same line or icon, or of the
+ * ringtone, which was not written yet. The buzzer's icons are not merged,
+ * it has to stop for a moment between hiding and showing them.
+ */
+static int queue_collapse(yldisp_cmd_type_t type, int index, int show,
+                          const char *data, int len)
+{
+  yldisp_cmd *cmd;
+  int i;
+
+  if ((type == YLDISP_CMD_ICON) &&
+      ((index == YLDISP_ICON_RINGTONE) || (index == YLDISP_ICON_SPEAKER)))
+    return 0;
+  for (cmd = module_data.queue_head; cmd; cmd = cmd->next) {
+    if ((cmd->type == type) && (cmd->index == index))
+      break;
+  }
+  if (!cmd)
+    return 0;
+
+  switch (type) {
+    case YLDISP_CMD_LINE:
+      /* both end with a '\0', a '\t' keeps what was written before */
+      for (i = 0; i < len - 1; i++) {
+        if ((i >= cmd->len - 1) || (data[i] != '\t'))
+          cmd->data[i] = data[i];
+      }
+      if (len > cmd->len) {
+        cmd->data[len - 1] = '\0';
+        cmd->len = len;
+      }
+      break;
+    case YLDISP_CMD_ICON:
+      cmd->show = show;
+      break;
+    case YLDISP_CMD_RINGTONE:
+      memcpy(cmd->data, data, len);
+      cmd->len = len;
+      break;
+  }
+  module_data.stats.collapsed++;
+  return 1;
+}
+
+/* commands not written yet */
+static unsigned long queue_depth()
+{
+  unsigned long depth = module_data.queue_len;
+
+#ifdef HAVE_PTHREAD_H
+  if (module_data.writer_running)
+    depth += writer.tail - writer.head;
+#endif
+  return depth;
+}
+
+static void queue_add(yldisp_cmd_type_t type, int index, int show,
+                      const char *data, int len)
+{
+  yldisp_cmd *cmd;
+  unsigned long queued;
+
+  if (len > RINGTONE_MAXLEN)
+    len = RINGTONE_MAXLEN;
+  if (queue_collapse(type, index, show, data, len))
+    return;
+
+  cmd = malloc(sizeof(*cmd));
+  if (!cmd) {
+    perror("__FILE__/__LINE__: malloc");
+    abort();
+  }
+  cmd->next = NULL;
+  cmd->type = type;
+  cmd->index = index;
+  cmd->show = show;
+  cmd->line3_delay = get_layout()->line3_delay;
+  yp_ml_get_time(&cmd->queued);
+  cmd->len = len;
+  if (data)
+    memcpy(cmd->data, data, cmd->len);
+
+  if (module_data.queue_tail)
+    module_data.queue_tail->next = cmd;
+  else
+    module_data.queue_head = cmd;
+  module_data.queue_tail = cmd;
+  module_data.queue_len++;
+
+  queued = queue_depth();
+  if (queued > module_data.stats.queued_max)
+    module_data.stats.queued_max = queued;
+  queue_run(0);
+}
+
+/*****************************************************************/
+
+/* Queues writes of the lines and icons which differ from the handset's
+ * state. Of a line only the changed positions are written, the others
+ * are replaced by '\t' which the driver skips.
+ */
+void yldisp_flush()
+{
+  char buf[YLDISP_LINE_MAX + 1];
+  char c;
+  int n, i, last;
+  unsigned long writes = 0;
+
+  if (module_data.flush_pending) {
+    yp_ml_remove_event(-1, YLDISP_FLUSH_ID);
+    module_data.flush_pending = 0;
+  }
+
+  for (n = 0; n < YLDISP_LINES; n++) {
+    last = -1;
+    for (i = 0; i < line_len[n]; i++) {
+      c = module_data.line[n][i];
+      if (c && (c != module_data.line_hw[n][i])) {
+        buf[i] = c;
+        module_data.line_hw[n][i] = c;
+        last = i;
+      }
+      else {
+        buf[i] = '\t';
+      }
+    }
+    if (last >= 0) {
+      buf[last + 1] = '\0';
+      queue_add(YLDISP_CMD_LINE, n, 0, buf, last + 2);
+      writes++;
+    }
+  }
+
+  for (i = 0; i < YLDISP_ICONS; i++) {
+    if (module_data.icon[i] &&
+        (module_data.icon[i] != module_data.icon_hw[i])) {
+      queue_add(YLDISP_CMD_ICON, i, (module_data.icon[i] == ICON_SHOWN),
+                NULL, 0);
+      module_data.icon_hw[i] = module_data.icon[i];
+      writes++;
+    }
   }
-  ylsysfs_write_control_file((ylsysfs_get_led_inverted()) ? "hide_icon" : "show_icon",
-                             "LED");
+
+  if (module_data.pending_updates > 0) {
+    module_data.stats.updates += module_data.pending_updates;
+    module_data.stats.writes += writes;
+    module_data.stats.flushes++;
+    module_data.pending_updates = 0;
+  }
+}
+
+static void flush_callback(int id, int group, void *private_data)
+{
+  module_data.flush_pending = 0;
+  yldisp_flush();
+}
+
+/* All changes made in the current loop iteration are written at its
+ * end, so a state transition results in a single flush.
+ */
+static void flush_later()
+{
+  module_data.pending_updates++;
+  if (module_data.flush_pending)
+    return;
+  if (yp_ml_defer(YLDISP_FLUSH_ID, 0, flush_callback, NULL) >= 0)
+    module_data.flush_pending = 1;
+  else
+    yldisp_flush();
+}
+
+static void line_clear(int n)
+{
+  memset(module_data.line[n], ' ', line_len[n]);
+  flush_later();
+}
+
+/* Sets a segment to 'text', which is cut or filled up with spaces */
+static void segment_update(yldisp_seg_t seg, const char *text)
+{
+  const yldisp_segment *sp = &get_layout()->segments[seg];
+  char *cp = &module_data.line[sp->line][sp->pos];
+  int i;
+
+  for (i = 0; i < sp->len; i++)
+    cp[i] = (*text) ? *text++ : ' ';
+  if (sp->len > 0)
+    flush_later();
+}
+
+/* Clears a segment and shows a dot at position 'mark' if it is >= 0 */
+static void segment_mark(yldisp_seg_t seg, int mark)
+{
+  const yldisp_segment *sp = &get_layout()->segments[seg];
+  char *cp = &module_data.line[sp->line][sp->pos];
+
+  if (sp->len > 0) {
+    memset(cp, ' ', sp->len);
+    if (mark < sp->len && mark >= 0)
+      cp[mark] = '.';
+    flush_later();
+  }
+}
+
+/* Icons the handset does not have are ignored */
+static void icon_update(yldisp_icon_t icon, int show)
+{
+  if (!(get_layout()->icons & (1 << icon)))
+    return;
+  module_data.icon[icon] = (show) ? ICON_SHOWN : ICON_HIDDEN;
+  flush_later();
 }
 
-static void led_off_callback(int id, int group, void *private_data) {
+static void idle_begin()
+{
+  struct yp_ml_stats ml;
+
+  yp_ml_get_stats(&ml);
+  yp_ml_get_time(&module_data.idle_since);
+  module_data.idle_since_wakeups = ml.wakeups;
+}
+
+/* Adds the time and wakeups since idle_begin() to the statistics */
+static void idle_account(struct yldisp_stats *stats)
+{
+  struct yp_ml_stats ml;
+  struct timeval now, tv;
+
+  yp_ml_get_stats(&ml);
+  yp_ml_get_time(&now);
+  timersub(&now, &module_data.idle_since, &tv);
+  stats->idle_ms += tv.tv_sec * 1000 + tv.tv_usec / 1000;
+  stats->idle_wakeups += ml.wakeups - module_data.idle_since_wakeups;
+}
+
+void yldisp_get_stats(struct yldisp_stats *stats)
+{
+  memcpy(stats, &module_data.stats, sizeof(*stats));
+  stats->queued = queue_depth();
+  HW_LOCK();
+  stats->written = hw.written;
+  stats->wait_us = hw.wait_us;
+  stats->wait_max_us = hw.wait_max_us;
+  HW_UNLOCK();
+  if (module_data.idle)
+    idle_account(stats);
+}
+
+/*****************************************************************/
+
+static void led_set(int on) {
+  module_data.led_lit = on;
+  if (ylsysfs_get_led_inverted())
+    on = !on;
+  icon_update(YLDISP_ICON_LED, on);
+}
+
+static void led_blink_callback(int id, int group, void *private_data) {
   (void) private_data;
   
-  if (module_data.blink_reschedule) {
-    yp_ml_schedule_timer(YLDISP_BLINK_ID, module_data.blink_on_time,
-                         led_on_callback, NULL);
-  }
-  ylsysfs_write_control_file((ylsysfs_get_led_inverted()) ? "show_icon" : "hide_icon",
-                             "LED");
+  /* toggle the LED and let the timer run until the next transition */
+  led_set(!module_data.led_lit);
+  yp_ml_reschedule_periodic_timer(id, (module_data.led_lit) ?
+                                      module_data.blink_on_time :
+                                      module_data.blink_off_time, 0);
 }
 
 void yldisp_led_blink(unsigned int on_time, unsigned int off_time) {
-  yp_ml_remove_event(-1, YLDISP_BLINK_ID);
-  
   module_data.blink_on_time = on_time;
   module_data.blink_off_time = off_time;
-  module_data.blink_reschedule = 0;
   
-  if (on_time > 0) {
-    /* turn on LED */
-    led_on_callback(0, 0, NULL);
-    
-    if (off_time > 0) {
-      module_data.blink_reschedule = 1;
-      yp_ml_schedule_periodic_timer(YLDISP_BLINK_ID, (on_time + off_time),
-                                    1, led_off_callback, NULL);
+  if ((on_time > 0) && (off_time > 0)) {
+    /* start with the LED on and reuse a running blink timer */
+    led_set(1);
+    if ((module_data.blink_id < 0) ||
+        (yp_ml_reschedule_periodic_timer(module_data.blink_id,
+                                         on_time, 0) < 0)) {
+      module_data.blink_id =
+        yp_ml_schedule_periodic_timer(YLDISP_BLINK_ID, on_time,
+                                      0, led_blink_callback, NULL);
+      yp_ml_set_timer_slack(module_data.blink_id, 30);
+      yp_ml_set_priority(module_data.blink_id, YP_ML_PRIO_DISPLAY);
     }
   }
   else {
-    /* turn off LED */
-    led_off_callback(0, 0, NULL);
+    if (module_data.blink_id >= 0) {
+      yp_ml_remove_event(-1, YLDISP_BLINK_ID);
+      module_data.blink_id = -1;
+    }
+    led_set(on_time > 0);
   }
 }
 
@@ -134,54 +1038,39 @@ void yldisp_led_on() {
 
 /*****************************************************************/
 
-static void show_date_callback(int id, int group, void *private_data) {
+static void show_seconds(int sec) {
+  char buf[4];
+
+  buf[0] = ' ';
+  buf[1] = '0' + sec / 10;
+  buf[2] = '0' + sec % 10;
+  buf[3] = '\0';
+  segment_update(YLDISP_SEG_SECONDS, buf);
+}
+
+static void show_date() {
   time_t t;
   struct tm *tms;
-  char line1[18];
-  char line2[10];
-
-  (void) private_data;
+  char buf[12];
 
   t = time(NULL);
   tms = localtime(&t);
   
-  strcpy(line2, "\t\t       ");
-  line2[tms->tm_wday + 2] = '.';
-  ylsysfs_write_control_file("line2", line2);
-
-  sprintf(line1, "%2d.%2d.%2d.%02d\t\t\t %02d",
-          tms->tm_mon + 1, tms->tm_mday,
-          tms->tm_hour, tms->tm_min, tms->tm_sec);
-  ylsysfs_write_control_file("line1", line1);
-}
-
-static void delayed_date_callback(int id, int group, void *private_data) {
-  module_data.wait_date_after_count = 0;
-  yldisp_show_date();
-}
-
-void yldisp_show_date() {
-  yp_ml_remove_event(-1, YLDISP_DATETIME_ID);
-  
-  if (module_data.wait_date_after_count) {
-    yp_ml_schedule_timer(YLDISP_DATETIME_ID, 5000,
-                         delayed_date_callback, NULL);
-  }
-  else {
-    show_date_callback(0, 0, NULL);
-    yp_ml_schedule_periodic_timer(YLDISP_DATETIME_ID, 1000,
-                                  1, show_date_callback, NULL);
-  }
+  segment_mark(YLDISP_SEG_WEEKDAY, tms->tm_wday);
+  snprintf(buf, sizeof(buf), "%2d.%2d.%2d.%02d",
+           tms->tm_mon + 1, tms->tm_mday, tms->tm_hour, tms->tm_min);
+  segment_update(YLDISP_SEG_CLOCK, buf);
+  if (module_data.idle)
+    segment_update(YLDISP_SEG_SECONDS, "");
+  else
+    show_seconds(tms->tm_sec);
 }
 
-
-static void show_counter_callback(int id, int group, void *private_data) {
+static void show_counter() {
   time_t diff;
-  char line1[18];
+  char buf[12];
   int h,m,s;
 
-  (void) private_data;
-
   diff = time(NULL) - module_data.counter_base;
   h = m = 0;
   s = diff % 60;
@@ -192,43 +1081,147 @@ static void show_counter_callback(int id, int group, void *private_data) {
       m -= h * 60;
     }
   }
-  sprintf(line1, "      %2d.%02d\t\t\t %02d", h, m, s);
-  ylsysfs_write_control_file("line1", line1);
-  ylsysfs_write_control_file("line2", "\t\t       ");
+  snprintf(buf, sizeof(buf), "      %2d.%02d", h, m);
+  segment_update(YLDISP_SEG_CLOCK, buf);
+  show_seconds(s);
+  segment_mark(YLDISP_SEG_WEEKDAY, -1);
 }
 
-void yldisp_show_counter() {
-  yp_ml_remove_event(-1, YLDISP_DATETIME_ID);
+static time_t monotonic_sec() {
+  struct timeval now;
+
+  yp_ml_get_time(&now);
+  return now.tv_sec;
+}
+
+/* Only an on-hook phone showing the date which needs no attention */
+static int idle_allowed() {
+  return (module_data.idle_timeout > 0) &&
+         (module_data.datetime_mode == YLDISP_DT_DATE) &&
+         (module_data.blink_id < 0) &&
+         (module_data.icon[YLDISP_ICON_DIALTONE] != ICON_SHOWN) &&
+         (module_data.icon[get_layout()->ringer] != ICON_SHOWN) &&
+         (monotonic_sec() - module_data.last_activity >=
+          module_data.idle_timeout);
+}
+
+static void datetime_callback(int id, int group, void *private_data);
+
+static void idle_enter() {
+  datetime_stop();
+  module_data.idle = 1;
+  idle_begin();
+  module_data.datetime_id =
+    yp_ml_schedule_aligned_timer(YLDISP_DATETIME_ID, YLDISP_IDLE_TICK,
+                                 datetime_callback, NULL);
+  yp_ml_set_timer_slack(module_data.datetime_id, 1000);
+  yp_ml_set_priority(module_data.datetime_id, YP_ML_PRIO_DISPLAY);
+  show_date();
+}
+
+/* The date, the call counter and the delay between both share a single
+ * timer which runs just after every full second of the wall clock, so the
+ * seconds are always up to date. Only the mode changes. In idle mode it
+ * runs once a minute.
+ */
+static void datetime_callback(int id, int group, void *private_data) {
+  (void) private_data;
+
+  switch (module_data.datetime_mode) {
+    case YLDISP_DT_WAIT_DATE:
+      if (--module_data.wait_date_ticks > 0)
+        break;
+      module_data.wait_date_after_count = 0;
+      module_data.datetime_mode = YLDISP_DT_DATE;
+      show_date();
+      break;
+    case YLDISP_DT_COUNTER:
+      show_counter();
+      break;
+    default:
+      show_date();
+      if (!module_data.idle && idle_allowed())
+        idle_enter();
+      break;
+  }
+}
+
+static void datetime_timer(yldisp_dt_mode_t mode) {
+  if (module_data.idle)
+    datetime_stop();
+  module_data.datetime_mode = mode;
+  if (module_data.datetime_id < 0) {
+    module_data.datetime_id =
+      yp_ml_schedule_aligned_timer(YLDISP_DATETIME_ID, 1000,
+                                   datetime_callback, NULL);
+    /* the seconds may well be shown a bit late */
+    yp_ml_set_timer_slack(module_data.datetime_id, 250);
+    yp_ml_set_priority(module_data.datetime_id, YP_ML_PRIO_DISPLAY);
+  }
+}
+
+static void datetime_stop() {
+  if (module_data.datetime_id >= 0) {
+    yp_ml_remove_event(-1, YLDISP_DATETIME_ID);
+    module_data.datetime_id = -1;
+  }
+  if (module_data.idle) {
+    idle_account(&module_data.stats);
+    module_data.idle = 0;
+  }
+}
+
+void yldisp_set_idle_timeout(int timeout) {
+  module_data.idle_timeout = (timeout > 0) ? timeout : 0;
+  yldisp_activity();
+}
+
+void yldisp_activity() {
+  module_data.last_activity = monotonic_sec();
+  if (module_data.idle) {
+    datetime_timer(YLDISP_DT_DATE);
+    show_date();
+  }
+}
+
+void yldisp_show_date() {
+  if (module_data.wait_date_after_count) {
+    /* keep the duration of the last call for 5 seconds */
+    module_data.wait_date_ticks = 5;
+    datetime_timer(YLDISP_DT_WAIT_DATE);
+  }
+  else {
+    datetime_timer(YLDISP_DT_DATE);
+    show_date();
+  }
+}
+
+static void reset_counter() {
   module_data.wait_date_after_count = 1;
   module_data.counter_base = time(NULL);
-  show_counter_callback(0, 0, NULL);
+  show_counter();
+}
+
+void yldisp_show_counter() {
+  datetime_stop();
+  reset_counter();
 }
 
 void yldisp_start_counter() {
-  yldisp_show_counter();
-  yp_ml_schedule_periodic_timer(YLDISP_DATETIME_ID, 1000,
-                                1, show_counter_callback, NULL);
+  reset_counter();
+  datetime_timer(YLDISP_DT_COUNTER);
 }
 
 
 void yldisp_stop_counter() {
-  yp_ml_remove_event(-1, YLDISP_DATETIME_ID);
+  datetime_stop();
 }
 
 /*****************************************************************/
 
 void set_yldisp_call_type(yl_call_type_t ct) {
-  char line1[14];
-  
-  strcpy(line1, "\t\t\t\t\t\t\t\t\t\t\t  ");
-  if (ct == YL_CALL_IN) {
-    line1[11] = '.';
-  }
-  else if (ct == YL_CALL_OUT) {
-    line1[12] = '.';
-  }
-  
-  ylsysfs_write_control_file("line1", line1);
+  segment_mark(YLDISP_SEG_CALL_IN, (ct == YL_CALL_IN) ? 0 : -1);
+  segment_mark(YLDISP_SEG_CALL_OUT, (ct == YL_CALL_OUT) ? 0 : -1);
 }
 
 
@@ -238,13 +1231,7 @@ yl_call_type_t get_yldisp_call_type() {
 
 
 void set_yldisp_store_type(yl_store_type_t st) {
-  char line1[15];
-  
-  strcpy(line1, "\t\t\t\t\t\t\t\t\t\t\t\t\t ");
-  if (st == YL_STORE_ON) {
-    line1[13] = '.';
-  }
-  ylsysfs_write_control_file("line1", line1);
+  segment_mark(YLDISP_SEG_STORE, (st == YL_STORE_ON) ? 0 : -1);
 }
 
 
@@ -254,111 +1241,91 @@ yl_store_type_t get_yldisp_store_type() {
 
 /*****************************************************************/
 
-#define RINGTONE_MAXLEN 256
-#define RING_DIR ".yeaphone/ringtone"
+int yldisp_has_ringtone()
+{
+  return (get_layout()->ringtone_format >= 0);
+}
+
+/* The ringtone is only uploaded if the handset does not have it yet */
 void set_yldisp_ringtone(char *ringname, unsigned char volume)
 {
-  int fd_in;
+  const ylringtone_bin *tone;
   char ringtone[RINGTONE_MAXLEN];
-  int len = 0;
-  char *ringfile;
-  char *home;
-  ylsysfs_model model;
+  int format = get_layout()->ringtone_format;
   
-  model = ylsysfs_get_model();
+  if (format < 0)
+    return;
 
-  if (model != YL_MODEL_P1K && model != YL_MODEL_P1KH)
+  tone = ylringtone_get(ringname, format);
+  if (!tone)
+    return;
+  if (module_data.ringtone_known &&
+      (module_data.ringtone_hash == tone->hash) &&
+      (module_data.ringtone_len == tone->len) &&
+      (module_data.ringtone_volume == volume))
     return;
 
   /* make sure the buzzer is turned off! */
   if (yp_ml_remove_event(-1, YLDISP_MINRING_ID) > 0) {
-    ylsysfs_write_control_file("hide_icon", "RINGTONE");
-    usleep(10000);   /* urgh! TODO: Get rid of the delay! */
-  }
-  /* ringname may be either a path relative to RINGDIR or an absolute path */
-  home = getenv("HOME");
-  if (home && (ringname[0] != '/')) {
-    len = strlen(home) + strlen(RING_DIR) + strlen(ringname) + 3;
-    ringfile = malloc(len);
-    strcpy(ringfile, home);
-    strcat(ringfile, "/"RING_DIR"/");
-    strcat(ringfile, ringname);
-  } else {
-    ringfile = strdup(ringname);
-  }
-
-  /* read binary file (replacing first byte with volume)
-  ** and write to ringtone control file
-  ** TODO: track changes - if unchanged, don't set it again
-  ** (write to current.ring file)
-  */
-  fd_in = open(ringfile, O_RDONLY);
-  if (fd_in >= 0)
-  {
-    len = read(fd_in, ringtone, RINGTONE_MAXLEN);
-    if (len > 4)
-    {
-      /* write volume (replace first byte) */
-      ringtone[0] = volume;
-      ylsysfs_write_control_file_buf("ringtone", ringtone, len);
-    }
-    else
-    {
-      fprintf(stderr, "too short ringfile %s (len=%d)\n", ringfile, len);
-    }
-    close(fd_in);
+    icon_update(get_layout()->ringer, 0);
+    yldisp_flush();
   }
-  else
-  {
-    fprintf(stderr, "can't open ringfile %s\n", ringfile);
-  }
-  
-  free(ringfile);
+
+  /* write volume (replace first byte) */
+  memcpy(ringtone, tone->data, tone->len);
+  ringtone[0] = volume;
+  module_data.ringtone_known = 1;
+  module_data.ringtone_hash = tone->hash;
+  module_data.ringtone_len = tone->len;
+  module_data.ringtone_volume = volume;
+  queue_add(YLDISP_CMD_RINGTONE, 0, 0, ringtone, tone->len);
 }
 
 
 static void yldisp_minring_callback(int id, int group, void *private_data) {
   (void) private_data;
   if (module_data.ring_off_delayed) {
-    ylsysfs_write_control_file("hide_icon", "RINGTONE");
+    icon_update(get_layout()->ringer, 0);
+    yldisp_flush();
     module_data.ring_off_delayed = 0;
   }
 }
 
-void set_yldisp_ringer(yl_ringer_state_t rs, int minring) {
-  ylsysfs_model model;
-  
-  model = ylsysfs_get_model();
+static void ringer_update(yl_ringer_state_t rs, int minring) {
+  yldisp_icon_t ringer = get_layout()->ringer;
 
   switch (rs) {
     case YL_RINGER_ON:
       if (yp_ml_remove_event(-1, YLDISP_MINRING_ID) > 0) {
-        ylsysfs_write_control_file("hide_icon",
-                 (model == YL_MODEL_P4K) ? "SPEAKER" : "RINGTONE");
-        usleep(10000);   /* urgh! TODO: Get rid of the delay! */
+        icon_update(ringer, 0);
+        yldisp_flush();
       }
       module_data.ring_off_delayed = 0;
       yp_ml_schedule_timer(YLDISP_MINRING_ID, minring,
                            yldisp_minring_callback, NULL);
-      ylsysfs_write_control_file("show_icon",
-               (model == YL_MODEL_P4K) ? "SPEAKER" : "RINGTONE");
+      icon_update(ringer, 1);
       break;
     case YL_RINGER_OFF_DELAYED:
       if (yp_ml_count_events(-1, YLDISP_MINRING_ID) > 0)
         module_data.ring_off_delayed = 1;
       else
-        ylsysfs_write_control_file("hide_icon",
-                 (model == YL_MODEL_P4K) ? "SPEAKER" : "RINGTONE");
+        icon_update(ringer, 0);
       break;
     case YL_RINGER_OFF:
-      ylsysfs_write_control_file("hide_icon",
-               (model == YL_MODEL_P4K) ? "SPEAKER" : "RINGTONE");
+      icon_update(ringer, 0);
       yp_ml_remove_event(-1, YLDISP_MINRING_ID);
       module_data.ring_off_delayed = 0;
       break;
   }
 }
 
+/* The ringer is not delayed until the end of the loop iteration, but it
+ * may have to wait for the hardware. */
+void set_yldisp_ringer(yl_ringer_state_t rs, int minring) {
+  ringer_update(rs, minring);
+  yldisp_flush();
+}
+
 yl_ringer_state_t get_yldisp_ringer() {
   return(0);
 }
@@ -372,7 +1339,7 @@ void yldisp_ringer_vol_down() {
 /*****************************************************************/
 
 void set_yldisp_text(char *text) {
-  ylsysfs_write_control_file("line3", text);
+  segment_update(YLDISP_SEG_TEXT, text);
 }
 
 char *get_yldisp_text() {
@@ -383,27 +1350,21 @@ char *get_yldisp_text() {
 
 void set_yldisp_pstn_mode(int enabled)
 {
-  ylsysfs_model model = ylsysfs_get_model();
-  if (model == YL_MODEL_B2K || model == YL_MODEL_B3G)
-    ylsysfs_write_control_file((enabled) ? "show_icon" : "hide_icon", "PSTN");
+  icon_update(YLDISP_ICON_PSTN, enabled);
 }
 
 /*****************************************************************/
 
 void set_yldisp_dial_tone(int enabled)
 {
-  ylsysfs_model model = ylsysfs_get_model();
-  if (model == YL_MODEL_B2K || model == YL_MODEL_B3G || model == YL_MODEL_P4K)
-    ylsysfs_write_control_file((enabled) ? "show_icon" : "hide_icon", "DIALTONE");
+  icon_update(YLDISP_ICON_DIALTONE, enabled);
 }
 
 /*****************************************************************/
 
 void set_yldisp_backlight(int enabled)
 {
-  ylsysfs_model model = ylsysfs_get_model();
-  if (model == YL_MODEL_P4K)
-    ylsysfs_write_control_file((enabled) ? "show_icon" : "hide_icon", "BACKLIGHT");
+  icon_update(YLDISP_ICON_BACKLIGHT, enabled);
 }
 
 /*****************************************************************/
@@ -412,9 +1373,9 @@ void yldisp_hide_all() {
   set_yldisp_ringer(YL_RINGER_OFF, 0);
   yldisp_led_off();
   yldisp_stop_counter();
-  ylsysfs_write_control_file("line1", "                 ");
-  ylsysfs_write_control_file("line2", "         ");
-  ylsysfs_write_control_file("line3", "            ");
+  line_clear(0);
+  line_clear(1);
+  line_clear(2);
   set_yldisp_pstn_mode(1);
   set_yldisp_dial_tone(0);
   set_yldisp_backlight(0);
@@ -422,3 +1383,103 @@ void yldisp_hide_all() {
 
 /*****************************************************************/
 
+static char scene_icon_state(scene_switch_t sw, int inverted) {
+  if (sw == SCENE_KEEP)
+    return ICON_UNKNOWN;
+  return ((sw == SCENE_ON) != inverted) ? ICON_SHOWN : ICON_HIDDEN;
+}
+
+/* Resolves the steady icons of each scene for a model, a steady LED may
+ * be inverted and icons the handset does not have are never set. */
+static void scenes_build(const yldisp_layout *layout) {
+  const yldisp_scene_desc *sd;
+  char *icon;
+  int i, j;
+
+  for (i = 0; i < YLDISP_SCENES; i++) {
+    sd = &scene_descs[i];
+    icon = module_data.scene_icon[i];
+    memset(icon, ICON_UNKNOWN, YLDISP_ICONS);
+    if ((sd->led_on == 0) != (sd->led_off == 0)) {
+      icon[YLDISP_ICON_LED] =
+        scene_icon_state((sd->led_on) ? SCENE_ON : SCENE_OFF,
+                         ylsysfs_get_led_inverted());
+    }
+    icon[YLDISP_ICON_BACKLIGHT] = scene_icon_state(sd->backlight, 0);
+    icon[YLDISP_ICON_DIALTONE] = scene_icon_state(sd->dial_tone, 0);
+    icon[YLDISP_ICON_PSTN] = scene_icon_state(sd->pstn, 0);
+    for (j = 0; j < YLDISP_ICONS; j++) {
+      if (!(layout->icons & (1 << j)))
+        icon[j] = ICON_UNKNOWN;
+    }
+  }
+}
+
+/* Only what differs from the current state is changed, a blinking LED
+ * keeps its phase if it blinks the same way. Everything is written in a
+ * single flush at the end.
+ */
+void yldisp_set_scene(yldisp_scene_t scene, int minring) {
+  const yldisp_scene_desc *sd = &scene_descs[scene];
+  const char *icon;
+  int i;
+
+  get_layout();
+  icon = module_data.scene_icon[scene];
+
+  if (sd->hide_all) {
+    datetime_stop();
+    line_clear(0);
+    line_clear(1);
+    line_clear(2);
+  }
+  if (sd->text)
+    segment_update(YLDISP_SEG_TEXT, sd->text);
+  if (sd->call_type)
+    set_yldisp_call_type(sd->call_type - 1);
+
+  if ((sd->led_on > 0) && (sd->led_off > 0)) {
+    if ((module_data.blink_id < 0) ||
+        (module_data.blink_on_time != sd->led_on) ||
+        (module_data.blink_off_time != sd->led_off))
+      yldisp_led_blink(sd->led_on, sd->led_off);
+  }
+  else if (icon[YLDISP_ICON_LED] != ICON_UNKNOWN) {
+    if (module_data.blink_id >= 0) {
+      yp_ml_remove_event(-1, YLDISP_BLINK_ID);
+      module_data.blink_id = -1;
+    }
+    module_data.blink_on_time = sd->led_on;
+    module_data.blink_off_time = sd->led_off;
+    module_data.led_lit = (sd->led_on > 0);
+  }
+  for (i = 0; i < YLDISP_ICONS; i++) {
+    if (icon[i] && (icon[i] != module_data.icon[i])) {
+      module_data.icon[i] = icon[i];
+      module_data.pending_updates++;
+    }
+  }
+  if (sd->ringer)
+    ringer_update(sd->ringer - 1, minring);
+
+  switch (sd->clock) {
+    case SCENE_CLOCK_DATE:
+      yldisp_show_date();
+      break;
+    case SCENE_CLOCK_COUNTER:
+      yldisp_start_counter();
+      break;
+    case SCENE_CLOCK_COUNTER_SHOW:
+      yldisp_show_counter();
+      break;
+    default:
+      break;
+  }
+
+  module_data.scene = scene;
+  yldisp_flush();
+}
+
+yldisp_scene_t get_yldisp_scene() {
+  return module_data.scene;
+}
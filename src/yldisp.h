@@ -34,14 +34,60 @@ typedef enum { YL_RINGER_OFF,
                YL_RINGER_OFF_DELAYED,
                YL_RINGER_ON } yl_ringer_state_t;
 
+typedef enum { YLDISP_SCENE_NONE,
+               YLDISP_SCENE_OFF,
+               YLDISP_SCENE_STARTUP,
+               YLDISP_SCENE_SHUTDOWN,
+               YLDISP_SCENE_REG_FAILED,
+               YLDISP_SCENE_IDLE,           /* registered */
+               YLDISP_SCENE_RINGING,
+               YLDISP_SCENE_CALLING,
+               YLDISP_SCENE_IN_CALL,
+               YLDISP_SCENE_CALL_END,
+               YLDISP_SCENE_ERROR,
+               YLDISP_SCENES } yldisp_scene_t;
+
+
+struct yldisp_stats {
+  unsigned long updates;    /* changes of a line or icon requested */
+  unsigned long writes;     /* writes to the handset actually needed */
+  unsigned long flushes;    /* batches of changes written */
+
+  /* the queue of writes to the handset */
+  unsigned long collapsed;  /* writes merged into a queued one */
+  unsigned long queued;     /* writes waiting now */
+  unsigned long queued_max; /* most writes waiting at once */
+  unsigned long written;    /* writes done */
+  unsigned long wait_us;    /* total time they waited in the queue */
+  unsigned long wait_max_us;
+
+  /* the idle mode */
+  unsigned long idle_ms;
+  unsigned long long idle_wakeups;  /* of the mainloop while idle */
+};
 
 void yldisp_clear();
 
+/* Changes of the display are collected and written at the end of the
+ * current mainloop iteration, yldisp_flush writes them right away. */
+void yldisp_flush();
+void yldisp_get_stats(struct yldisp_stats *stats);
+
+/* Writes to the handset in a separate thread, so the mainloop never waits
+ * for it. Returns -ENOSYS if threads are not available. */
+int yldisp_set_writer_thread(int enable);
+
 void yldisp_led_blink(unsigned int on_time, unsigned int off_time);
 void yldisp_led_off();
 void yldisp_led_on();
 
 void yldisp_show_date();
+
+/* Without activity for 'timeout' seconds the date is shown without the
+ * seconds and updated once a minute only, 0 disables this. Keys and
+ * changes of the phone's state call yldisp_activity(). */
+void yldisp_set_idle_timeout(int timeout);
+void yldisp_activity();
 void yldisp_show_counter();
 void yldisp_start_counter();
 void yldisp_stop_counter();
@@ -52,6 +98,8 @@ yl_call_type_t get_yldisp_call_type();
 void set_yldisp_store_type(yl_store_type_t st);
 yl_store_type_t get_yldisp_store_type();
 
+/* whether the handset plays a ringtone which can be set */
+int yldisp_has_ringtone();
 void set_yldisp_ringtone(char *ringname, unsigned char volume);
 
 void set_yldisp_ringer(yl_ringer_state_t rs, int minring);
@@ -70,4 +118,10 @@ void set_yldisp_backlight(int enabled);
 
 void yldisp_hide_all();
 
+/* What the handset shows in a state of the phone. The text of the
+ * scenes which do not set one, like the caller's number, is set before.
+ * 'minring' is the minimum duration of YLDISP_SCENE_RINGING in [ms]. */
+void yldisp_set_scene(yldisp_scene_t scene, int minring);
+yldisp_scene_t get_yldisp_scene();
+
 #endif
@@ -0,0 +1,465 @@
+/****************************************************************************
+ *
+ *  File: ylringtone.c
+ *
+ *  Copyright (C) 2006 - 2008  Thomas Reitmayr <treitmayr@devbase.at>
+ *
+ ****************************************************************************
+ *
+ *  This file is part of Yeaphone.
+ *
+ *  Yeaphone is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "ylringtone.h"
+#include "ypconfig.h"
+
+#ifdef DMALLOC
+#include <dmalloc.h>
+#endif
+
+/*****************************************************************/
+
+#define RING_DIR ".yeaphone/ringtone"
+#define RING_KEY "ringtone_"
+#define RING_SUFFIX ".ring"
+#define BIN_SUFFIX  ".bin"
+
+#define RING_DEFAULT_VOLUME  239
+#define RING_MAX_NOTES       RINGTONE_MAXLEN    /* more fit no format */
+#define RING_MAX_NESTING     8
+#define RING_LINE_MAX        256
+
+static const char *format_names[YLRINGTONE_FORMATS] = { "P1K", "P1KH" };
+
+typedef struct ring_note ring_note;
+struct ring_note {
+  int freq;                 /* [Hz], 0 for silence */
+  int duration;             /* [1/100 s] */
+};
+
+typedef struct ring_seq ring_seq;
+struct ring_seq {
+  int volume;
+  int num;
+  ring_note notes[RING_MAX_NOTES];
+};
+
+static ylringtone *ringtones = NULL;
+
+/*****************************************************************/
+
+/* FNV-1a, ringtones differing in their volume only get the same hash */
+static unsigned int ringtone_hash(const char *data, int len)
+{
+  unsigned int hash = 2166136261u;
+  int i;
+
+  for (i = 1; i < len; i++) {
+    hash ^= (unsigned char) data[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/*****************************************************************/
+
+/* ringname may be either a path relative to RING_DIR or an absolute path */
+static char *ringtone_file(const char *ringname)
+{
+  char *ringfile;
+  char *home;
+  
+  home = getenv("HOME");
+  if (home && (ringname[0] != '/')) {
+    ringfile = malloc(strlen(home) + strlen(RING_DIR) +
+                      strlen(ringname) + 3);
+    if (!ringfile) {
+      perror("__FILE__/__LINE__: malloc");
+      abort();
+    }
+    strcpy(ringfile, home);
+    strcat(ringfile, "/"RING_DIR"/");
+    strcat(ringfile, ringname);
+  } else {
+    ringfile = strdup(ringname);
+  }
+  return ringfile;
+}
+
+/*****************************************************************/
+
+/* Parses the next 'num' words of the current line as numbers within
+ * [min, max], there must not be any more words. */
+static int ring_args(long *args, int num, long min, long max)
+{
+  char *word, *end;
+  int i;
+
+  for (i = 0; i < num; i++) {
+    word = strtok(NULL, " \t\r\n");
+    if (!word)
+      return -1;
+    args[i] = strtol(word, &end, 0);
+    if (*end || (args[i] < min) || (args[i] > max))
+      return -1;
+  }
+  return (strtok(NULL, " \t\r\n")) ? -1 : 0;
+}
+
+static int ring_add(ring_seq *seq, int freq, long ms)
+{
+  if (seq->num >= RING_MAX_NOTES)
+    return -1;
+  seq->notes[seq->num].freq = freq;
+  seq->notes[seq->num].duration = (ms + 5) / 10;
+  if (seq->notes[seq->num].duration == 0)
+    seq->notes[seq->num].duration = 1;
+  seq->num++;
+  return 0;
+}
+
+/* Reads the text notation, see ylringtone.h */
+static int ring_parse(FILE *fp, const char *ringfile, ring_seq *seq)
+{
+  char line[RING_LINE_MAX];
+  char *cmd, *cp;
+  const char *error = NULL;
+  long args[2];
+  int start[RING_MAX_NESTING];
+  long count[RING_MAX_NESTING];
+  int depth = 0;
+  int lineno = 0;
+  int i, n;
+
+  seq->volume = RING_DEFAULT_VOLUME;
+  seq->num = 0;
+
+  while (!error && fgets(line, sizeof(line), fp)) {
+    lineno++;
+    cp = strchr(line, '#');
+    if (cp)
+      *cp = '\0';
+    cmd = strtok(line, " \t\r\n");
+    if (!cmd)
+      continue;
+
+    if (!strcmp(cmd, "volume")) {
+      if (ring_args(args, 1, 0, 255) < 0)
+        error = "expected volume <0-255>";
+      else
+        seq->volume = args[0];
+    }
+    else if (!strcmp(cmd, "tone")) {
+      if (ring_args(args, 2, 1, 65535) < 0 || args[0] < 2)
+        error = "expected tone <2-65535 Hz> <1-65535 ms>";
+      else if (ring_add(seq, args[0], args[1]) < 0)
+        error = "too many notes";
+    }
+    else if (!strcmp(cmd, "silence")) {
+      if (ring_args(args, 1, 1, 65535) < 0)
+        error = "expected silence <1-65535 ms>";
+      else if (ring_add(seq, 0, args[0]) < 0)
+        error = "too many notes";
+    }
+    else if (!strcmp(cmd, "repeat")) {
+      if (ring_args(args, 1, 1, RING_MAX_NOTES) < 0)
+        error = "expected repeat <count>";
+      else if (depth >= RING_MAX_NESTING)
+        error = "repeat nested too deeply";
+      else {
+        start[depth] = seq->num;
+        count[depth] = args[0];
+        depth++;
+      }
+    }
+    else if (!strcmp(cmd, "end")) {
+      if (ring_args(args, 0, 0, 0) < 0)
+        error = "unexpected words after end";
+      else if (depth == 0)
+        error = "end without repeat";
+      else {
+        depth--;
+        n = seq->num - start[depth];
+        if (seq->num + n * (count[depth] - 1) > RING_MAX_NOTES)
+          error = "too many notes";
+        else {
+          for (i = 1; i < count[depth]; i++) {
+            memcpy(&seq->notes[seq->num], &seq->notes[start[depth]],
+                   n * sizeof(ring_note));
+            seq->num += n;
+          }
+        }
+      }
+    }
+    else
+      error = "unknown command";
+  }
+
+  if (!error) {
+    if (depth > 0)
+      error = "missing end of repeat";
+    else if (seq->num == 0)
+      error = "no notes";
+  }
+  if (error) {
+    fprintf(stderr, "%s:%d: %s\n", ringfile, lineno, error);
+    return -1;
+  }
+  return 0;
+}
+
+/* Returns the length of the ringtone in 'format', or -1 if it does not
+ * fit. Notes longer than the format allows are split up. */
+static int ring_encode(ring_seq *seq, ylringtone_format format,
+                       char *data, const char *ringfile)
+{
+  int entry_len = (format == YLRINGTONE_G1) ? 4 : 2;
+  int max_units = (format == YLRINGTONE_G1) ? 0xffff : 0xff;
+  int len = 0;
+  int i, units, n, divisor;
+
+  data[len++] = seq->volume;
+  for (i = 0; i < seq->num; i++) {
+    /* the frequency parameter is 0x10000 - f, the highest one is silent */
+    divisor = (seq->notes[i].freq) ? 0x10000 - seq->notes[i].freq : 0xffff;
+    if ((format == YLRINGTONE_G2) && !(divisor & 0xff)) {
+      /* the G2 format uses the lower byte only, 0 ends the sequence */
+      fprintf(stderr, "%s: %d Hz can't be played by the %s\n",
+              ringfile, seq->notes[i].freq, format_names[format]);
+      return -1;
+    }
+    for (units = seq->notes[i].duration; units > 0; units -= n) {
+      n = (units < max_units) ? units : max_units;
+      if (len + entry_len + 2 > RINGTONE_MAXLEN) {
+        fprintf(stderr, "%s: too long for the %s (max. %d bytes)\n",
+                ringfile, format_names[format], RINGTONE_MAXLEN);
+        return -1;
+      }
+      if (format == YLRINGTONE_G1) {
+        data[len++] = divisor >> 8;
+        data[len++] = divisor & 0xff;
+        data[len++] = n >> 8;
+        data[len++] = n & 0xff;
+      }
+      else {
+        data[len++] = divisor & 0xff;
+        data[len++] = n;
+      }
+    }
+  }
+  /* end of sequence */
+  data[len++] = 0;
+  data[len++] = 0;
+  return len;
+}
+
+/* Compiles a ".ring" file for all formats it fits */
+static int ringtone_compile(const char *ringfile, ylringtone *tone)
+{
+  FILE *fp;
+  ring_seq *seq;
+  ylringtone_format format;
+  int res, num = 0;
+
+  fp = fopen(ringfile, "r");
+  if (!fp) {
+    fprintf(stderr, "can't open ringfile %s\n", ringfile);
+    return 0;
+  }
+  seq = malloc(sizeof(*seq));
+  if (!seq) {
+    perror("__FILE__/__LINE__: malloc");
+    abort();
+  }
+  if (ring_parse(fp, ringfile, seq) == 0) {
+    for (format = 0; format < YLRINGTONE_FORMATS; format++) {
+      res = ring_encode(seq, format, tone->bin[format].data, ringfile);
+      tone->bin[format].len = (res > 0) ? res : 0;
+      if (res > 0)
+        num++;
+    }
+  }
+  free(seq);
+  fclose(fp);
+  return num;
+}
+
+/* Reads a binary ringtone, it is used for all formats */
+static int ringtone_read(const char *ringfile, ylringtone *tone)
+{
+  ylringtone_format format;
+  int fd_in;
+  int len;
+  /* one more byte to find out if the file is too long */
+  char buf[RINGTONE_MAXLEN + 1];
+  
+  fd_in = open(ringfile, O_RDONLY);
+  if (fd_in < 0) {
+    fprintf(stderr, "can't open ringfile %s\n", ringfile);
+    return 0;
+  }
+  len = read(fd_in, buf, sizeof(buf));
+  close(fd_in);
+
+  if (len <= 4) {
+    fprintf(stderr, "too short ringfile %s (len=%d)\n", ringfile, len);
+    return 0;
+  }
+  if (len > RINGTONE_MAXLEN) {
+    fprintf(stderr, "too long ringfile %s (max. %d bytes)\n",
+            ringfile, RINGTONE_MAXLEN);
+    return 0;
+  }
+  for (format = 0; format < YLRINGTONE_FORMATS; format++) {
+    memcpy(tone->bin[format].data, buf, len);
+    tone->bin[format].len = len;
+  }
+  return YLRINGTONE_FORMATS;
+}
+
+/*****************************************************************/
+
+/* The bundled ringtones used to be installed as ".bin" files, they are
+ * ".ring" files now. Returns 'ringfile' or the ".ring" file to use
+ * instead of it. */
+static char *ringtone_bin_fallback(char *ringfile)
+{
+  char *ring;
+  int len;
+
+  len = strlen(ringfile) - strlen(BIN_SUFFIX);
+  if ((len <= 0) || strcmp(ringfile + len, BIN_SUFFIX) ||
+      (access(ringfile, F_OK) == 0) || (errno != ENOENT))
+    return ringfile;
+
+  ring = malloc(len + strlen(RING_SUFFIX) + 1);
+  if (!ring) {
+    perror("__FILE__/__LINE__: malloc");
+    abort();
+  }
+  memcpy(ring, ringfile, len);
+  strcpy(ring + len, RING_SUFFIX);
+  if (access(ring, F_OK) != 0) {
+    free(ring);
+    return ringfile;
+  }
+  fprintf(stderr, "ringfile %s not found, using %s\n", ringfile, ring);
+  free(ringfile);
+  return ring;
+}
+
+static ylringtone *ringtone_load(const char *ringname)
+{
+  ylringtone *tone;
+  ylringtone_format format;
+  char *ringfile;
+  int len, num;
+  
+  tone = malloc(sizeof(*tone));
+  if (!tone) {
+    perror("__FILE__/__LINE__: malloc");
+    abort();
+  }
+  ringfile = ringtone_bin_fallback(ringtone_file(ringname));
+  len = strlen(ringfile) - strlen(RING_SUFFIX);
+  if ((len > 0) && !strcmp(ringfile + len, RING_SUFFIX))
+    num = ringtone_compile(ringfile, tone);
+  else
+    num = ringtone_read(ringfile, tone);
+  free(ringfile);
+  if (num == 0) {
+    free(tone);
+    return NULL;
+  }
+
+  for (format = 0; format < YLRINGTONE_FORMATS; format++) {
+    tone->bin[format].hash = ringtone_hash(tone->bin[format].data,
+                                           tone->bin[format].len);
+  }
+  tone->name = strdup(ringname);
+  tone->next = ringtones;
+  ringtones = tone;
+  return tone;
+}
+
+/*****************************************************************/
+
+static ylringtone *ringtone_find(const char *ringname)
+{
+  ylringtone *tone;
+
+  for (tone = ringtones; tone; tone = tone->next) {
+    if (!strcmp(tone->name, ringname))
+      return tone;
+  }
+  return NULL;
+}
+
+/*****************************************************************/
+
+static void preload_callback(const char *key, const char *val, void *priv)
+{
+  int *num = priv;
+
+  if (!*val || ringtone_find(val))
+    return;
+  if (ringtone_load(val))
+    (*num)++;
+}
+
+int ylringtone_preload()
+{
+  int num = 0;
+
+  ylringtone_free_all();
+  ypconfig_foreach(RING_KEY, preload_callback, &num);
+  return num;
+}
+
+/*****************************************************************/
+
+const ylringtone_bin *ylringtone_get(const char *name,
+                                     ylringtone_format format)
+{
+  ylringtone *tone;
+
+  tone = ringtone_find(name);
+  if (!tone)
+    tone = ringtone_load(name);
+  return (tone && tone->bin[format].len > 0) ? &tone->bin[format] : NULL;
+}
+
+/*****************************************************************/
+
+void ylringtone_free_all()
+{
+  ylringtone *next;
+
+  while (ringtones) {
+    next = ringtones->next;
+    free(ringtones->name);
+    free(ringtones);
+    ringtones = next;
+  }
+}
+
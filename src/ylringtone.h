@@ -0,0 +1,72 @@
+/****************************************************************************
+ *
+ *  File: ylringtone.h
+ *
+ *  Copyright (C) 2006 - 2008  Thomas Reitmayr <treitmayr@devbase.at>
+ *
+ ****************************************************************************
+ *
+ *  This file is part of Yeaphone.
+ *
+ *  Yeaphone is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+#ifndef YLRINGTONE_H
+#define YLRINGTONE_H
+
+/* the size of a ringtone including the leading volume byte */
+#define RINGTONE_MAXLEN 256
+
+/* binary formats of the ringtone control file: G1 for the P1K with a 16 bit
+ * frequency divisor and duration per note, G2 for the P1KH with 8 bits */
+typedef enum { YLRINGTONE_G1, YLRINGTONE_G2, YLRINGTONE_FORMATS } ylringtone_format;
+
+typedef struct ylringtone_bin ylringtone_bin;
+struct ylringtone_bin {
+  unsigned int hash;        /* of the data following the volume byte */
+  int len;                  /* 0 if the ringtone does not fit the format */
+  char data[RINGTONE_MAXLEN];
+};
+
+typedef struct ylringtone ylringtone;
+struct ylringtone {
+  char *name;               /* as configured, eg. "default.ring" */
+  ylringtone_bin bin[YLRINGTONE_FORMATS];
+  ylringtone *next;
+};
+
+/* Loads all ringtones named by "ringtone_*" entries of the configuration
+ * into memory, returns the number of valid ones. Ringtones loaded
+ * before are dropped.
+ *
+ * Files ending in ".ring" are compiled from a text notation with one
+ * command per line ('#' starts a comment):
+ *   volume <0-255>      volume of the ringtone, the default is 239
+ *   tone <Hz> <ms>      a note
+ *   silence <ms>        a pause
+ *   repeat <n>          repeat the commands up to the matching "end"
+ *   end                 n times
+ * Durations are rounded to 10ms. Any other file is used as it is. */
+int ylringtone_preload();
+
+/* Returns the ringtone 'name' in 'format', which is read from disk if it
+ * was not preloaded, or NULL if it is not valid. */
+const ylringtone_bin *ylringtone_get(const char *name,
+                                     ylringtone_format format);
+
+void ylringtone_free_all();
+
+#endif
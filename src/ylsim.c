@@ -0,0 +1,584 @@
+/****************************************************************************
+ *
+ *  File: ylsim.c
+ *
+ *  Copyright (C) 2006 - 2008  Thomas Reitmayr <treitmayr@devbase.at>
+ *
+ ****************************************************************************
+ *
+ *  This file is part of Yeaphone.
+ *
+ *  Yeaphone is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <linux/input.h>
+#include "config.h"
+#include "ylsim.h"
+#include "ylsysfs.h"
+#include "ypmainloop.h"
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#ifdef DMALLOC
+#include <dmalloc.h>
+#endif
+
+/*****************************************************************/
+
+#define YLSIM_RELEASE_ID  40
+#define YLSIM_STDIN_ID    41
+#define YLSIM_RENDER_ID   42
+
+#define YLSIM_EVENT_FILE  "event"
+#define YLSIM_PRESS       100     /* [ms] a key is held */
+#define YLSIM_LONG_PRESS  1500    /* [ms] a key is held for a long press */
+#define YLSIM_INPUT_MAX   64
+
+/* the files the driver provides, "model" is created separately */
+static const char *control_names[] = {
+  "line1", "line2", "line3", "show_icon", "hide_icon", "ringtone", NULL
+};
+static const int line_len[YLSIM_LINES] = { 17, 9, 12 };
+
+typedef struct ylsim_data ylsim_data;
+struct ylsim_data {
+  char *dir;
+  int event_fd;
+  
+  /* the write hook may run in yldisp's writer thread, these are only
+   * used with 'lock' held */
+  struct ylsim_display display;
+  struct ylsim_stats stats;
+  struct timeval key_time;
+  int key_pending;              /* a key press waits for the display */
+  int write_delay;              /* [us] a write to the handset blocks */
+
+  int held_code;                /* key pressed by ylsim_char, or -1 */
+  int held_shift;
+  char input[YLSIM_INPUT_MAX];  /* characters waiting for their turn */
+  int input_len;
+  int terminal;
+  volatile int render_pending;
+#ifdef HAVE_PTHREAD_H
+  pthread_t owner;              /* the thread which runs the mainloop */
+#endif
+};
+
+static ylsim_data module_data = {
+  dir:      NULL,
+  event_fd: -1,
+  held_code: -1
+};
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+#define SIM_LOCK()    pthread_mutex_lock(&lock)
+#define SIM_UNLOCK()  pthread_mutex_unlock(&lock)
+#else
+#define SIM_LOCK()
+#define SIM_UNLOCK()
+#endif
+
+/* The write hook runs in yldisp's writer thread if there is one. The
+ * mainloop may not run yet, so yp_ml_same_thread() cannot tell. */
+static int in_owner_thread()
+{
+#ifdef HAVE_PTHREAD_H
+  return pthread_equal(pthread_self(), module_data.owner);
+#else
+  return 1;
+#endif
+}
+
+/*****************************************************************/
+
+static char *sim_path(const char *name)
+{
+  char *path;
+
+  path = malloc(strlen(module_data.dir) + strlen(name) + 2);
+  if (!path) {
+    perror("__FILE__/__LINE__: malloc");
+    abort();
+  }
+  sprintf(path, "%s/%s", module_data.dir, name);
+  return path;
+}
+
+static int create_file(const char *name, const char *contents)
+{
+  char *path = sim_path(name);
+  int fd, res = 0;
+
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 ||
+      (contents && write(fd, contents, strlen(contents)) < 0)) {
+    res = (errno > 0) ? -errno : -1;
+    perror(path);
+  }
+  if (fd >= 0)
+    close(fd);
+  free(path);
+  return res;
+}
+
+static void remove_file(const char *name)
+{
+  char *path = sim_path(name);
+
+  unlink(path);
+  free(path);
+}
+
+/*****************************************************************/
+
+static void render_task(void *private_data)
+{
+  module_data.render_pending = 0;
+  ylsim_render(stdout);
+  fflush(stdout);
+}
+
+static void render_callback(int id, int group, void *private_data)
+{
+  render_task(private_data);
+}
+
+static void set_icon(const char *buf, int size, int show)
+{
+  struct ylsim_display *disp = &module_data.display;
+  char name[32];
+  int i;
+
+  /* the driver ignores a trailing newline */
+  if (size > 0 && buf[size - 1] == '\n')
+    size--;
+  if (size >= sizeof(name))
+    size = sizeof(name) - 1;
+  memcpy(name, buf, size);
+  name[size] = '\0';
+
+  for (i = 0; disp->icon_names[i]; i++) {
+    if (!strcmp(disp->icon_names[i], name))
+      break;
+  }
+  if (!disp->icon_names[i]) {
+    if (i >= YLSIM_ICONS - 1) {
+      fprintf(stderr, "simulator: too many icons, ignoring %s\n", name);
+      return;
+    }
+    disp->icon_names[i] = strdup(name);
+  }
+  disp->icon_shown[i] = show;
+}
+
+/* Interprets a write to a control file like the driver does. It may be
+ * called by yldisp's writer thread, but never by two threads at once. */
+static void write_hook(const char *control, const char *buf, int size)
+{
+  struct ylsim_display *disp = &module_data.display;
+  struct timeval now, diff;
+  unsigned long latency;
+  int n, i, delay;
+
+  SIM_LOCK();
+  delay = module_data.write_delay;
+  SIM_UNLOCK();
+  if (delay > 0)
+    usleep(delay);
+
+  SIM_LOCK();
+  if (!strncmp(control, "line", 4) &&
+      (control[4] >= '1') && (control[4] <= '0' + YLSIM_LINES)) {
+    /* a '\t' keeps the character at its position */
+    n = control[4] - '1';
+    for (i = 0; (i < size) && (i < line_len[n]); i++) {
+      if (buf[i] != '\t')
+        disp->line[n][i] = buf[i];
+    }
+  }
+  else if (!strcmp(control, "show_icon"))
+    set_icon(buf, size, 1);
+  else if (!strcmp(control, "hide_icon"))
+    set_icon(buf, size, 0);
+  else if (!strcmp(control, "ringtone")) {
+    disp->ringtone_len = (size < RINGTONE_MAXLEN) ? size : RINGTONE_MAXLEN;
+    memcpy(disp->ringtone, buf, disp->ringtone_len);
+  }
+  else {
+    SIM_UNLOCK();
+    return;
+  }
+
+  yp_ml_get_time(&now);
+  disp->writes++;
+  disp->last_write = now;
+
+  if (module_data.key_pending) {
+    module_data.key_pending = 0;
+    timersub(&now, &module_data.key_time, &diff);
+    latency = diff.tv_sec * 1000000 + diff.tv_usec;
+    if ((module_data.stats.latencies == 0) ||
+        (latency < module_data.stats.latency_min))
+      module_data.stats.latency_min = latency;
+    if (latency > module_data.stats.latency_max)
+      module_data.stats.latency_max = latency;
+    module_data.stats.latency_sum += latency;
+    module_data.stats.latencies++;
+  }
+  SIM_UNLOCK();
+
+  if (module_data.terminal &&
+      __sync_bool_compare_and_swap(&module_data.render_pending, 0, 1)) {
+    if (!in_owner_thread())
+      yp_ml_post(render_task, NULL);
+    else if (yp_ml_defer(YLSIM_RENDER_ID, 0, render_callback, NULL) < 0)
+      module_data.render_pending = 0;
+  }
+}
+
+/*****************************************************************/
+
+int ylsim_start(const char *model)
+{
+  const char *tmpdir;
+  char *event_path;
+  char *model_line;
+  int i, res;
+
+  if (!model)
+    model = "P1K";
+  if (strcmp(model, "P1K") && strcmp(model, "P1KH") &&
+      strcmp(model, "P4K") && strcmp(model, "B2K") && strcmp(model, "B3G")) {
+    fprintf(stderr, "simulator: unknown model %s\n", model);
+    return -EINVAL;
+  }
+
+  tmpdir = getenv("TMPDIR");
+  if (!tmpdir)
+    tmpdir = "/tmp";
+  module_data.dir = malloc(strlen(tmpdir) + 24);
+  if (!module_data.dir) {
+    perror("__FILE__/__LINE__: malloc");
+    abort();
+  }
+  sprintf(module_data.dir, "%s/yeaphone-sim.XXXXXX", tmpdir);
+  if (!mkdtemp(module_data.dir)) {
+    res = (errno > 0) ? -errno : -1;
+    perror(module_data.dir);
+    free(module_data.dir);
+    module_data.dir = NULL;
+    return res;
+  }
+
+  for (i = 0; control_names[i]; i++) {
+    res = create_file(control_names[i], NULL);
+    if (res < 0)
+      goto remove_and_leave;
+  }
+  model_line = malloc(strlen(model) + 2);
+  if (!model_line) {
+    perror("__FILE__/__LINE__: malloc");
+    abort();
+  }
+  sprintf(model_line, "%s\n", model);
+  res = create_file("model", model_line);
+  free(model_line);
+  if (res < 0)
+    goto remove_and_leave;
+
+  /* opening the FIFO for reading and writing does not block, and keeps
+   * it open for the reader */
+  event_path = sim_path(YLSIM_EVENT_FILE);
+  if (mkfifo(event_path, 0600) ||
+      (module_data.event_fd = open(event_path, O_RDWR | O_NONBLOCK)) < 0) {
+    res = (errno > 0) ? -errno : -1;
+    perror(event_path);
+    free(event_path);
+    goto remove_and_leave;
+  }
+
+  SIM_LOCK();
+  memset(&module_data.display, 0, sizeof(module_data.display));
+  for (i = 0; i < YLSIM_LINES; i++)
+    memset(module_data.display.line[i], ' ', line_len[i]);
+  memset(&module_data.stats, 0, sizeof(module_data.stats));
+  module_data.key_pending = 0;
+  SIM_UNLOCK();
+
+  ylsysfs_set_sysfs_path(module_data.dir);
+  ylsysfs_set_event_path(event_path);
+#ifdef HAVE_PTHREAD_H
+  module_data.owner = pthread_self();
+#endif
+  ylsysfs_set_write_hook(write_hook);
+  free(event_path);
+
+  printf("simulating a %s in %s\n", model, module_data.dir);
+  return 0;
+
+remove_and_leave:
+  ylsim_stop();
+  return res;
+}
+
+/*****************************************************************/
+
+void ylsim_stop()
+{
+  struct ylsim_display *disp = &module_data.display;
+  int i;
+
+  ylsysfs_set_write_hook(NULL);
+  yp_ml_remove_event(-1, YLSIM_RELEASE_ID);
+  yp_ml_remove_event(-1, YLSIM_STDIN_ID);
+  yp_ml_remove_event(-1, YLSIM_RENDER_ID);
+  module_data.terminal = 0;
+  module_data.render_pending = 0;
+  module_data.held_code = -1;
+  module_data.input_len = 0;
+
+  if (module_data.event_fd >= 0) {
+    close(module_data.event_fd);
+    module_data.event_fd = -1;
+  }
+  if (module_data.dir) {
+    for (i = 0; control_names[i]; i++)
+      remove_file(control_names[i]);
+    remove_file("model");
+    remove_file(YLSIM_EVENT_FILE);
+    rmdir(module_data.dir);
+    free(module_data.dir);
+    module_data.dir = NULL;
+  }
+  SIM_LOCK();
+  for (i = 0; disp->icon_names[i]; i++) {
+    free((char *) disp->icon_names[i]);
+    disp->icon_names[i] = NULL;
+  }
+  SIM_UNLOCK();
+}
+
+/*****************************************************************/
+
+int ylsim_key(int code, int pressed)
+{
+  struct input_event event;
+
+  if (module_data.event_fd < 0)
+    return -ENODEV;
+
+  memset(&event, 0, sizeof(event));
+  gettimeofday(&event.time, NULL);
+  event.type = EV_KEY;
+  event.code = code;
+  event.value = pressed;
+  if (write(module_data.event_fd, &event, sizeof(event)) != sizeof(event))
+    return (errno > 0) ? -errno : -EIO;
+
+  if (pressed) {
+    SIM_LOCK();
+    module_data.stats.keys++;
+    yp_ml_get_time(&module_data.key_time);
+    module_data.key_pending = 1;
+    SIM_UNLOCK();
+  }
+  return 0;
+}
+
+/*****************************************************************/
+
+static int char_to_key(char c, int *shift)
+{
+  *shift = 0;
+  switch (c) {
+    case '1': case '2': case '3': case '4': case '5':
+    case '6': case '7': case '8': case '9':
+      return KEY_1 + c - '1';
+    case '0':
+      return KEY_0;
+    case '*':
+      return KEY_KPASTERISK;
+    case '#':
+      /* the driver reports '#' as a shifted '3' */
+      *shift = 1;
+      return KEY_3;
+    case 'c':
+      return KEY_BACKSPACE;
+    case 'g':
+      return KEY_ENTER;
+    case 'r':
+      return KEY_ESC;
+    case 'u':
+      return KEY_UP;
+    case 'd':
+      return KEY_DOWN;
+    case '+':
+      return KEY_VOLUMEUP;
+    case '-':
+      return KEY_VOLUMEDOWN;
+    case 'p':
+    case 'h':
+      return KEY_PHONE;
+  }
+  return -1;
+}
+
+static void release_key()
+{
+  if (module_data.held_code == KEY_PHONE)
+    ;                           /* pick up and hang up are not released */
+  else if (module_data.held_code >= 0)
+    ylsim_key(module_data.held_code, 0);
+  if (module_data.held_shift)
+    ylsim_key(KEY_LEFTSHIFT, 0);
+  module_data.held_code = -1;
+  module_data.held_shift = 0;
+}
+
+static void release_callback(int id, int group, void *private_data)
+{
+  char c;
+
+  release_key();
+  if (module_data.input_len > 0) {
+    c = module_data.input[0];
+    module_data.input_len--;
+    memmove(module_data.input, module_data.input + 1, module_data.input_len);
+    ylsim_char(c);
+  }
+}
+
+int ylsim_char(char c)
+{
+  int code, shift, lng;
+
+  lng = (c >= 'A') && (c <= 'Z');
+  code = char_to_key((lng) ? c - 'A' + 'a' : c, &shift);
+  if (code < 0)
+    return -EINVAL;
+
+  if (module_data.held_code >= 0) {
+    /* wait until the key before is released */
+    if (module_data.input_len >= YLSIM_INPUT_MAX)
+      return -ENOSPC;
+    module_data.input[module_data.input_len++] = c;
+    return 0;
+  }
+
+  if (shift)
+    ylsim_key(KEY_LEFTSHIFT, 1);
+  /* the phone key reports picking up as pressed, hanging up as released */
+  ylsim_key(code, (tolower(c) != 'h'));
+  module_data.held_code = code;
+  module_data.held_shift = shift;
+  yp_ml_schedule_timer(YLSIM_RELEASE_ID, (lng) ? YLSIM_LONG_PRESS :
+                                                 YLSIM_PRESS,
+                       release_callback, NULL);
+  return 0;
+}
+
+/*****************************************************************/
+
+void ylsim_set_write_delay(int usec)
+{
+  SIM_LOCK();
+  module_data.write_delay = usec;
+  SIM_UNLOCK();
+}
+
+/*****************************************************************/
+
+void ylsim_get_display(struct ylsim_display *disp)
+{
+  SIM_LOCK();
+  memcpy(disp, &module_data.display, sizeof(*disp));
+  SIM_UNLOCK();
+}
+
+void ylsim_get_stats(struct ylsim_stats *stats)
+{
+  SIM_LOCK();
+  memcpy(stats, &module_data.stats, sizeof(*stats));
+  SIM_UNLOCK();
+}
+
+/*****************************************************************/
+
+void ylsim_render(FILE *fp)
+{
+  struct ylsim_display display;
+  struct ylsim_display *disp = &display;
+  int i;
+
+  ylsim_get_display(disp);
+  fprintf(fp, "+-----------------+\n");
+  for (i = 0; i < YLSIM_LINES; i++)
+    fprintf(fp, "|%-17s|\n", disp->line[i]);
+  fprintf(fp, "+-----------------+\n");
+  for (i = 0; disp->icon_names[i]; i++) {
+    if (disp->icon_shown[i])
+      fprintf(fp, " %s", disp->icon_names[i]);
+  }
+  fprintf(fp, "\n");
+}
+
+/*****************************************************************/
+
+static void stdin_callback(int id, int group, void *private_data)
+{
+  char buf[YLSIM_INPUT_MAX];
+  int len, i;
+
+  len = read(0, buf, sizeof(buf));
+  if (len <= 0) {
+    yp_ml_remove_event(-1, YLSIM_STDIN_ID);
+    return;
+  }
+  for (i = 0; i < len; i++) {
+    if (buf[i] <= ' ')
+      continue;
+    if (ylsim_char(buf[i]) == -EINVAL)
+      fprintf(stderr, "simulator: no key for '%c'\n", buf[i]);
+  }
+}
+
+int ylsim_watch_terminal()
+{
+  int res;
+
+  res = yp_ml_poll_io(YLSIM_STDIN_ID, 0, stdin_callback, NULL);
+  if (res < 0)
+    return res;
+  /* reading the terminal is input like the keys of the handset */
+  yp_ml_set_priority(res, YP_ML_PRIO_INPUT);
+  module_data.terminal = 1;
+  ylsim_render(stdout);
+  return 0;
+}
+
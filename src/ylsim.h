@@ -0,0 +1,93 @@
+/****************************************************************************
+ *
+ *  File: ylsim.h
+ *
+ *  Copyright (C) 2006 - 2008  Thomas Reitmayr <treitmayr@devbase.at>
+ *
+ ****************************************************************************
+ *
+ *  This file is part of Yeaphone.
+ *
+ *  Yeaphone is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+#ifndef YLSIM_H
+#define YLSIM_H
+
+#include <stdio.h>
+#include <sys/time.h>
+#include "ylringtone.h"
+
+/* A simulated handset: a directory with the control files of a handset
+ * and a FIFO instead of the event device. What is written to the control
+ * files is kept as a model of the display, key presses are injected into
+ * the FIFO. */
+
+#define YLSIM_LINES     3
+#define YLSIM_LINE_MAX  17
+#define YLSIM_ICONS     16
+
+struct ylsim_display {
+  char line[YLSIM_LINES][YLSIM_LINE_MAX + 1];
+  const char *icon_names[YLSIM_ICONS];    /* NULL terminated */
+  int icon_shown[YLSIM_ICONS];
+  int ringtone_len;
+  char ringtone[RINGTONE_MAXLEN];
+  unsigned long writes;
+  struct timeval last_write;              /* mainloop time */
+};
+
+struct ylsim_stats {
+  unsigned long keys;                     /* key presses injected */
+  unsigned long latencies;                /* of those the display followed */
+  unsigned long latency_sum;              /* [us] from a key press to the */
+  unsigned long latency_min;              /* next write to the handset */
+  unsigned long latency_max;
+};
+
+/* Creates the directory of a simulated handset 'model' (eg. "P1K", NULL
+ * for the default) in $TMPDIR and makes ylsysfs use it. To be called in
+ * the thread which runs the mainloop. */
+int ylsim_start(const char *model);
+void ylsim_stop();
+
+/* Injects a key event as the yealink driver reports it, 'code' is a
+ * linux key code. */
+int ylsim_key(int code, int pressed);
+
+/* Presses and releases the key for a character like on the keypad: digits,
+ * '*', '#', 'c' (C), 'g' (green), 'r' (red), 'u'/'d' (up/down), '+'/'-'
+ * (volume), 'p'/'h' (pick up/hang up). A capital letter holds the key
+ * for a long press. Returns -EINVAL for other characters. */
+int ylsim_char(char c);
+
+/* Makes every write to the display take 'usec', like a slow USB
+ * transfer does. */
+void ylsim_set_write_delay(int usec);
+
+/* Copies of the display and statistics, the display may be changed by
+ * yldisp's writer thread meanwhile */
+void ylsim_get_display(struct ylsim_display *disp);
+void ylsim_get_stats(struct ylsim_stats *stats);
+
+/* Prints the display as a box of text */
+void ylsim_render(FILE *fp);
+
+/* Reads characters from stdin as key presses (see ylsim_char) and prints
+ * the display on stdout whenever it changed. */
+int ylsim_watch_terminal();
+
+#endif
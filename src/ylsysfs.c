@@ -35,8 +35,13 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <errno.h>
+#include "config.h"
 #include "ylsysfs.h"
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 #ifdef DMALLOC
 #include <dmalloc.h>
 #endif
@@ -56,6 +61,8 @@ struct ylsysfs_data {
   
   ylsysfs_model model;
   int led_inverted;
+
+  ylsysfs_write_hook write_hook;
 };
 
 static ylsysfs_data module_data = {
@@ -66,6 +73,41 @@ static ylsysfs_data module_data = {
   model:      YL_MODEL_UNKNOWN
 };
 
+/* Control files which are written (or read) often are kept open while
+ * the device is present. Other control files are opened per access.
+ */
+struct control_file {
+  const char *name;
+  int flags;
+  int fd;
+  int users;                    /* accesses in progress with 'fd' */
+  int closing;                  /* the last user closes 'fd' */
+};
+
+/* yldisp may write the control files from its writer thread, so the
+ * paths and the cached fds are only used with 'control_lock' held. The
+ * lock is not held while writing, which blocks until the handset has
+ * the data, an fd in use stays open until the access is done. */
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t control_lock = PTHREAD_MUTEX_INITIALIZER;
+#define CONTROL_LOCK()    pthread_mutex_lock(&control_lock)
+#define CONTROL_UNLOCK()  pthread_mutex_unlock(&control_lock)
+#else
+#define CONTROL_LOCK()
+#define CONTROL_UNLOCK()
+#endif
+
+static struct control_file control_files[] = {
+  { "line1",     O_WRONLY, -1, 0, 0 },
+  { "line2",     O_WRONLY, -1, 0, 0 },
+  { "line3",     O_WRONLY, -1, 0, 0 },
+  { "show_icon", O_WRONLY, -1, 0, 0 },
+  { "hide_icon", O_WRONLY, -1, 0, 0 },
+  { "ringtone",  O_WRONLY, -1, 0, 0 },
+  { "model",     O_RDONLY, -1, 0, 0 },
+  { NULL, 0, -1, 0, 0 }
+};
+
 /*****************************************************************/
 /* forward declarations */
 
@@ -451,13 +493,99 @@ static void determine_model()
 
 /*****************************************************************/
 
+static void close_control_files()
+{
+  struct control_file *cf;
+
+  for (cf = control_files; cf->name; cf++) {
+    if (cf->users > 0)
+      cf->closing = 1;
+    else if (cf->fd >= 0) {
+      close(cf->fd);
+      cf->fd = -1;
+    }
+  }
+}
+
+/* Returns an fd for the control file, which may be used without the
+ * lock until it is handed to release_control_file(). 'cf' is set to the
+ * cache entry which keeps it open, or NULL. Returns -errno on failure.
+ */
+static int open_control_file(const char *control, int flags,
+                             struct control_file **cf)
+{
+  struct control_file *entry;
+  int fd;
+
+  *cf = NULL;
+  if (!module_data.path_buf || !module_data.path_sysfs)
+    return -ENOENT;
+
+  for (entry = control_files; entry->name; entry++) {
+    if ((entry->flags == flags) && !strcmp(entry->name, control))
+      break;
+  }
+  if (entry->name && !entry->closing) {
+    *cf = entry;
+    if (entry->fd >= 0) {
+      entry->users++;
+      return entry->fd;
+    }
+  }
+
+  strcpy(module_data.path_buf, module_data.path_sysfs);
+  strcat(module_data.path_buf, control);
+  fd = open(module_data.path_buf, flags);
+  if (fd < 0) {
+    *cf = NULL;
+    perror(module_data.path_buf);
+    return (errno > 0) ? -errno : -1;
+  }
+  if (*cf) {
+    (*cf)->fd = fd;
+    (*cf)->users++;
+  }
+  return fd;
+}
+
+/* Ends an access with an fd of open_control_file() */
+static void release_control_file(struct control_file *cf, int fd)
+{
+  if (cf == NULL) {
+    close(fd);
+    return;
+  }
+  if ((--cf->users == 0) && cf->closing) {
+    close(cf->fd);
+    cf->fd = -1;
+    cf->closing = 0;
+  }
+}
+
+/* Called after an access to a control file failed with 'err'. Once the
+ * device is gone none of the cached fds is of any use.
+ */
+static void control_file_error(const char *control, int err)
+{
+  fprintf(stderr, "%s%s: %s\n", module_data.path_sysfs, control,
+          strerror(err));
+  if ((err == ENODEV) || (err == ENOENT))
+    close_control_files();
+}
+
+/*****************************************************************/
+
 int ylsysfs_find_device(const char *uniq)
 {
   int ret;
   
-  if ((ret = find_input_dir(uniq)) != 0)
-    return ret;
-  if ((ret = find_alsa_card()) != 0)
+  CONTROL_LOCK();
+  close_control_files();
+  ret = find_input_dir(uniq);
+  if (ret == 0)
+    ret = find_alsa_card();
+  CONTROL_UNLOCK();
+  if (ret != 0)
     return ret;
   
   determine_model();
@@ -471,26 +599,32 @@ int ylsysfs_write_control_file_buf(const char *control,
                                    const char *buf,
                                    int size)
 {
-  FILE *fp;
-  int res;
+  struct control_file *cf;
+  ylsysfs_write_hook hook;
+  int fd, res;
   
-  if (!module_data.path_buf || !module_data.path_sysfs)
-    return -ENOENT;
-
-  strcpy(module_data.path_buf, module_data.path_sysfs);
-  strcat(module_data.path_buf, control);
-  
-  fp = fopen(module_data.path_buf, "wb");
-  if (fp) {
-    res = fwrite(buf, 1, size, fp);
-    if (res < size)
-      perror(module_data.path_buf);
-    fclose(fp);
-  }
-  else {
-    perror(module_data.path_buf);
+  CONTROL_LOCK();
+  fd = open_control_file(control, O_WRONLY, &cf);
+  hook = module_data.write_hook;
+  CONTROL_UNLOCK();
+  if (fd < 0)
+    return fd;
+
+  /* every write is a separate store into the attribute */
+  res = pwrite(fd, buf, size, 0);
+  if (res < 0)
     res = (errno > 0) ? -errno : -1;
-  }
+  CONTROL_LOCK();
+  release_control_file(cf, fd);
+  if (res < 0)
+    control_file_error(control, -res);
+  CONTROL_UNLOCK();
+  if (res < 0)
+    return res;
+  if (res < size)
+    fprintf(stderr, "%s: short write (%d of %d bytes)\n", control, res, size);
+  if (hook)
+    hook(control, buf, res);
   
   return res;
 }
@@ -509,26 +643,24 @@ int ylsysfs_read_control_file_buf(const char *control,
                                   char *buf,
                                   int size)
 {
-  FILE *fp;
-  int res;
+  struct control_file *cf;
+  int fd, res;
   
-  if (!module_data.path_buf || !module_data.path_sysfs)
-    return -ENOENT;
-
-  strcpy(module_data.path_buf, module_data.path_sysfs);
-  strcat(module_data.path_buf, control);
-  
-  fp = fopen(module_data.path_buf, "rb");
-  if (fp) {
-    res = fread(buf, 1, size, fp);
-    if (res < 0)
-      perror(module_data.path_buf);
-    fclose(fp);
-  }
-  else {
-    perror(module_data.path_buf);
+  CONTROL_LOCK();
+  fd = open_control_file(control, O_RDONLY, &cf);
+  CONTROL_UNLOCK();
+  if (fd < 0)
+    return fd;
+
+  /* reading from the start makes sysfs generate the contents again */
+  res = pread(fd, buf, size, 0);
+  if (res < 0)
     res = (errno > 0) ? -errno : -1;
-  }
+  CONTROL_LOCK();
+  release_control_file(cf, fd);
+  if (res < 0)
+    control_file_error(control, -res);
+  CONTROL_UNLOCK();
   
   return res;
 }
@@ -547,6 +679,56 @@ int ylsysfs_read_control_file(const char *control,
 
 /*****************************************************************/
 
+int ylsysfs_set_sysfs_path(const char *path)
+{
+  int plen = strlen(path) + 2;
+
+  CONTROL_LOCK();
+  close_control_files();
+  if (module_data.path_sysfs)
+    free(module_data.path_sysfs);
+  if (module_data.path_buf)
+    free(module_data.path_buf);
+  module_data.path_sysfs = malloc(plen);
+  module_data.path_buf = malloc(plen + 50);
+  if (!module_data.path_sysfs || !module_data.path_buf) {
+    perror("__FILE__/__LINE__: malloc");
+    abort();
+  }
+  strcpy(module_data.path_sysfs, path);
+  if ((plen == 2) || (path[plen - 3] != '/'))
+    strcat(module_data.path_sysfs, "/");
+  CONTROL_UNLOCK();
+
+  determine_model();
+  return 0;
+}
+
+/*****************************************************************/
+
+int ylsysfs_set_event_path(const char *path)
+{
+  if (module_data.path_event)
+    free(module_data.path_event);
+  module_data.path_event = strdup(path);
+  if (!module_data.path_event) {
+    perror("__FILE__/__LINE__: strdup");
+    abort();
+  }
+  return 0;
+}
+
+/*****************************************************************/
+
+void ylsysfs_set_write_hook(ylsysfs_write_hook hook)
+{
+  CONTROL_LOCK();
+  module_data.write_hook = hook;
+  CONTROL_UNLOCK();
+}
+
+/*****************************************************************/
+
 const char *ylsysfs_get_sysfs_path()
 {
   return module_data.path_sysfs;
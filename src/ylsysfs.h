@@ -39,6 +39,18 @@ enum ylsysfs_model {
 
 int ylsysfs_find_device(const char *uniq);
 
+/* Uses 'path' as the sysfs directory of the handset instead of looking
+ * for one, eg. a fake directory for benchmarks. */
+int ylsysfs_set_sysfs_path(const char *path);
+int ylsysfs_set_event_path(const char *path);
+
+/* 'hook' sees every successful write to a control file, eg. to keep a
+ * copy of the display. NULL removes it. While yldisp's writer thread
+ * runs, the hook is called in that thread only. */
+typedef void (*ylsysfs_write_hook)(const char *control,
+                                   const char *buf, int size);
+void ylsysfs_set_write_hook(ylsysfs_write_hook hook);
+
 const char *ylsysfs_get_sysfs_path();
 const char *ylsysfs_get_event_path();
 
@@ -46,6 +58,8 @@ ylsysfs_model ylsysfs_get_model();
 int ylsysfs_get_led_inverted();
 int ylsysfs_get_alsa_card();
 
+/* The control files may be accessed from any thread, yldisp's writer
+ * thread does all writes to the display while it runs. */
 int ylsysfs_write_control_file_buf(const char *control,
                                    const char *buf,
                                    int size);
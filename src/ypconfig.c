@@ -171,6 +171,25 @@ char *ypconfig_get_value(const char *key) {
 }
 
 
+int ypconfig_foreach(const char *prefix,
+                     void (*callback)(const char *key, const char *val,
+                                      void *priv),
+                     void *priv) {
+  yc_dll_t *current = yl_dll_root;
+  int len = strlen(prefix);
+  int num = 0;
+  
+  while (current) {
+    if (!strncmp(current->key, prefix, len)) {
+      callback(current->key, current->val, priv);
+      num++;
+    }
+    current = current->next;
+  }
+  return num;
+}
+
+
 void ypconfig_set_pair(const char *key, const char *value) {
   yc_dll_t **current;
   current = &yl_dll_root;
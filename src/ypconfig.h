@@ -30,6 +30,11 @@
 
 int ypconfig_read(const char *fname);
 char *ypconfig_get_value(const char *key);
+/* calls 'callback' for all pairs whose key starts with 'prefix' */
+int ypconfig_foreach(const char *prefix,
+                     void (*callback)(const char *key, const char *val,
+                                      void *priv),
+                     void *priv);
 void ypconfig_set_pair(const char *key, const char *value);
 int ypconfig_write(char *fname);
 
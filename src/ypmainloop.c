@@ -29,8 +29,12 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <signal.h>
 
 #include "ypmainloop.h"
 #include "config.h"
@@ -39,9 +43,45 @@
 #include <pthread.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+#ifdef HAVE_SYS_SIGNALFD_H
+#include <sys/signalfd.h>
+#endif
+
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
+
 
-#define INITIAL_EV_LIST_SIZE 10
-#define TIMER_MIN_RESOLUTIN  10         /* in [ms] */
+#define INITIAL_EV_LIST_SIZE 16         /* must be a power of 2 */
+#define INITIAL_GROUP_SIZE   16         /* must be a power of 2 */
+#define TIMER_MIN_RESOLUTIN  YP_ML_RESOLUTION
+#define MAX_READY_EVENTS     32         /* per call of the backend's wait */
+
+#define MAX_POSTED_TASKS     1024       /* run per loop iteration */
+#define ML_HIST_BUCKETS      24         /* log2 histogram of [us] */
+#define ML_PRIO_CLASSES      4          /* number of yp_ml_priority values */
+
+#define READY_WAKEUP        -1          /* index of the internal pipe */
+#define READY_SIGNAL        -2          /* index of the signal fd */
+#define READY_CLOCK         -3          /* index of the clock change fd */
+
+/* An event id consists of the slot index in 'ev_list' and a generation
+ * counter of the slot, so an id does not match any more once its event
+ * was removed, even if the slot was reused in the meantime.
+ */
+#define EV_SLOT_BITS         16
+#define EV_SLOT_MASK         ((1 << EV_SLOT_BITS) - 1)
+#define EV_GEN_MASK          0x7fff
+#define EV_MAKE_ID(slot, gen) (((gen) << EV_SLOT_BITS) | (slot))
+#define EV_ID_SLOT(id)       ((id) & EV_SLOT_MASK)
 
 
 #define TIMEVAL_TO_MS(tv) (((tv)->tv_sec * 1000L) + ((tv)->tv_usec / 1000))
@@ -56,408 +96,1891 @@ enum event_type {
   EV_TYPE_EMPTY = 0,
   EV_TYPE_TIMER,
   EV_TYPE_PTIMER,
-  EV_TYPE_IO
+  EV_TYPE_ATIMER,         /* periodic, aligned to the wall clock */
+  EV_TYPE_IO,
+  EV_TYPE_IDLE,
+  EV_TYPE_SIGNAL
 };
 
 struct event_list {
   enum event_type type;
   int event_id;
   int group_id;
-  int fd;
+  int fd;                 /* signal number for EV_TYPE_SIGNAL */
   struct timeval interval;
   struct timeval expire;
   yp_ml_callback callback;
   void *callback_data;
   int processed;
+  int heap_pos;           /* position in the timer heap, -1 if none */
+  unsigned int seq;       /* keeps timers with equal expiry in order */
+  yp_ml_catchup_policy catchup;
+  struct timeval slack;   /* how late the timer may run when coalescing */
+  yp_ml_priority priority;
+  int generation;
+  int next_free;          /* free list, only valid if EV_TYPE_EMPTY */
+  int group_prev;         /* list of all events of the same group */
+  int group_next;
+};
+
+/* log2 histogram, bucket i counts values in [2^i, 2^(i+1)) us */
+struct ml_hist {
+  unsigned long count;
+  unsigned long long total;
+  unsigned long max;
+  unsigned long bucket[ML_HIST_BUCKETS];
+};
+
+/* collected per group while profiling is enabled */
+struct ml_group_stats {
+  struct ml_hist run;     /* run time of the callbacks */
+  struct ml_hist late;    /* delay of timer callbacks after their expiry */
+};
+
+/* head of a group's event list, kept in an open addressing hash */
+struct group_entry {
+  int group_id;
+  int first;              /* -1 .. unused hash slot */
+  int count;
+  struct ml_group_stats *stats;
+};
+
+/* an fd reported by the backend, 'index' refers to 'ev_list' */
+struct ready_event {
+  int index;
+  int event_id;
+  int error;
+};
+
+/* The io multiplexing backend. Registering and unregistering an fd must
+ * not depend on the number of events, 'wait' fills 'ready' with at most
+ * 'max_ready' entries and returns their number (or -errno).
+ */
+struct ml_data_s;
+
+struct ml_backend {
+  const char *name;
+  int (*init)(struct ml_data_s *ml);
+  void (*shutdown)(struct ml_data_s *ml);
+  int (*add_fd)(struct ml_data_s *ml, int fd, int index, int event_id);
+  int (*del_fd)(struct ml_data_s *ml, int fd);
+  int (*wait)(struct ml_data_s *ml, int timeout,
+              struct ready_event *ready, int max_ready);
+};
+
+/* An io event or expired timer collected for dispatch in this iteration.
+ * 'fired' is the expiry of a timer when it was taken from the heap.
+ */
+struct ml_run_item {
+  int index;
+  int event_id;
+  yp_ml_priority priority;
+  struct timeval fired;
+};
+
+/* A task posted from any thread, linked into an intrusive lock-free
+ * multi-producer single-consumer queue (D. Vyukov). Producers only swap
+ * the head, the loop thread is the only one to touch the tail.
+ */
+struct ml_task {
+  struct ml_task * volatile next;
+  yp_ml_task_callback callback;
+  void *callback_data;
+};
+
+struct ml_task_queue {
+  struct ml_task * volatile head;
+  struct ml_task *tail;
+  struct ml_task stub;
 };
 
 struct ml_data_s {
   struct event_list *ev_list;
-  int ev_list_used;
   int ev_list_allocated;
-  int event_id_max;
+  int free_head;
+  unsigned int seq;
+
+  struct group_entry *groups;
+  int groups_allocated;
+  int groups_used;
+
+  /* timers ordered by expiry (binary min-heap of 'ev_list' indices) */
+  int *heap;
+  int heap_used;
+  int heap_allocated;
+
+  /* timers (re)scheduled while dispatching, they get into the heap
+   * only after the dispatch has finished */
+  int *pending;
+  int pending_used;
+  int pending_allocated;
+  int dispatching;
+  int current_event;      /* id of the timer whose callback is running */
+
+  /* events to dispatch in this iteration, run in order of priority */
+  struct ml_run_item *run;
+  int run_used;
+  int run_allocated;
+
+  /* ids of deferred callbacks in the order they were added, ids of
+   * removed events are dropped when the list is processed */
+  int *idle;
+  int idle_used;
+  int idle_allocated;
+  int idle_checked;     /* the loop looked for work without waiting */
+
+  const struct ml_backend *backend;
 
   fd_set select_master_set;
   int select_max_fd;
+  int epoll_fd;
   
-  int wakeup_read, wakeup_write;
+  yp_ml_catchup_policy default_catchup;
+  struct timeval default_slack;
+  yp_ml_priority default_priority;
+  struct timeval budget;  /* for the lower priority classes, 0 .. none */
+  int coalescing;
+  int profiling;
+  volatile int dump_requested;
+  const char *stats_file;
+  struct yp_ml_stats stats;
+
+  struct ml_task_queue tasks;
+
+  int wakeup_read, wakeup_write;    /* the same fd if it is an eventfd */
+
+  /* watched signals arrive through a signalfd or a self-pipe */
+  int sig_read, sig_write;          /* sig_write < 0 for a signalfd */
+  sigset_t sig_mask;
+  int clock_fd;                     /* readable when the time is set */
+  volatile int wakeup_signalled;    /* a wakeup is outstanding */
   int is_running;
-  int is_awake;
   pthread_t thread;
 };
 
-static struct ml_data_s ml_data;
+/* the instance used by the yp_ml_* functions */
+static struct ml_data_s ml_default;
+
+static int ml_cleanup(struct ml_data_s *ml);
 
 /*****************************************************************/
 
-int yp_ml_init()
+/* All timers are based on the monotonic clock, so setting the system
+ * time does not affect them. Note that on Linux CLOCK_MONOTONIC stops
+ * while the system is suspended, timers are just delayed by that time.
+ */
+static void ml_get_time(struct timeval *tv)
 {
-  int fd[2];
-  int ret = 0;
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
 
-  /*if (ml_data.is_running) {
-    fprintf(stderr, "Cannot call yp_ml_init while mainloop is running\n");
-    abort();
-  }*/
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+    tv->tv_sec = ts.tv_sec;
+    tv->tv_usec = ts.tv_nsec / 1000;
+    return;
+  }
+#endif
+  gettimeofday(tv, NULL);
+}
 
-  memset(&ml_data, 0, sizeof(ml_data));
+/*****************************************************************/
+/* timer heap                                                    */
 
-  /* preallocate event list */
-  ml_data.ev_list_used = 0;
-  ml_data.ev_list_allocated = INITIAL_EV_LIST_SIZE;
-  ml_data.ev_list = calloc(ml_data.ev_list_allocated, sizeof(ml_data.ev_list[0]));
-  if (!ml_data.ev_list) {
-    fprintf(stderr, "Cannot allocate memory for event list\n");
-    return -ENOMEM;
-  }
-  ml_data.event_id_max = 0;
+static inline int heap_less(struct ml_data_s *ml, int a, int b)
+{
+  struct event_list *ea = &ml->ev_list[a];
+  struct event_list *eb = &ml->ev_list[b];
 
-  ret = pipe(fd);
-  if (ret != 0) {
-    perror("Cannot create internal pipe");
-    free(ml_data.ev_list);
-    return ret;
-  }
-  ml_data.wakeup_read = fd[0];
-  ml_data.wakeup_write = fd[1];
-  
-  /* prepare bit fields for 'select' call */
-  FD_SET(fd[0], &ml_data.select_master_set);
-  ml_data.select_max_fd = fd[0] + 1;
-  
-  return 0;
+  if (timercmp(&ea->expire, &eb->expire, !=))
+    return timercmp(&ea->expire, &eb->expire, <);
+  /* equal expiry -> keep the order of scheduling */
+  return ((int) (ea->seq - eb->seq) < 0);
 }
 
-/*****************************************************************/
+static inline void heap_set(struct ml_data_s *ml, int pos, int index)
+{
+  ml->heap[pos] = index;
+  ml->ev_list[index].heap_pos = pos;
+}
 
-int yp_ml_run()
+static void heap_sift_up(struct ml_data_s *ml, int pos)
 {
-  struct event_list *current;
-  fd_set read_set;
-  /*fd_set write_set;*/
-  fd_set except_set;
-  struct timeval tv, now;
-  int ret, index, i;
-  int result;
+  int index = ml->heap[pos];
+  int parent;
 
-  if (ml_data.is_running) {
-    fprintf(stderr, "mainloop is already running\n");
-    return 0;
-  }
-  if (ml_data.select_max_fd == 0) {
-    fprintf(stderr, "mainloop not initialized\n");
-    return -EFAULT;
+  while (pos > 0) {
+    parent = (pos - 1) / 2;
+    if (!heap_less(ml, index, ml->heap[parent]))
+      break;
+    heap_set(ml, pos, ml->heap[parent]);
+    pos = parent;
   }
-  ml_data.is_running = 1;
-  result = 0;
-  ml_data.thread  = pthread_self();
-  
-  while (ml_data.is_running) {
-    /* find the timer to expire next */
-    tv.tv_sec = 0;
-    current = ml_data.ev_list;
-    for (i = 0; i < ml_data.ev_list_used; i++, current++) {
-      if ((current->type == EV_TYPE_TIMER) ||
-          (current->type == EV_TYPE_PTIMER)) {
-        if ((tv.tv_sec == 0) ||
-            timercmp(&current->expire, &tv, <)) {
-          tv.tv_sec = current->expire.tv_sec;
-          tv.tv_usec = current->expire.tv_usec;
-        }
-        /* reset all 'processed' flags (used below) */
-        current->processed = 0;
-      }
-    }
-    if (tv.tv_sec == 0) {
-      /* no timer -> wait for 1 hour */
-      tv.tv_sec = 3600;
-      tv.tv_usec = 0;
-    }
-    else {
-      /* calculate the duration to wait in 'select' */
-      gettimeofday(&now, NULL);
-      timersub(&tv, &now, &tv);      /* tv -= now */
-      if ((tv.tv_sec < 0)  || (tv.tv_usec < 0)) {
-        /* timer already expired -> 'select' will not wait */
-        tv.tv_sec = 0;
-        tv.tv_usec = 0;
-      }
-    }
-    
-    /* wait for a timer or io event */
-    memcpy(&read_set, &ml_data.select_master_set, sizeof(fd_set));
-    /*memcpy(&write_set, &ml_data.select_master_set, sizeof(fd_set));*/
-    memcpy(&except_set, &ml_data.select_master_set, sizeof(fd_set));
+  heap_set(ml, pos, index);
+}
 
-    ret = select(ml_data.select_max_fd,
-                 &read_set, NULL/*&write_set*/, &except_set, &tv);
+static void heap_sift_down(struct ml_data_s *ml, int pos)
+{
+  int index = ml->heap[pos];
+  int child;
 
-    if (ret > 0) {
-      /* io event */
-      current = ml_data.ev_list;
-      for (i = 0; i < ml_data.ev_list_used; i++, current++) {
-        if ((current->type == EV_TYPE_IO) &&
-            (current->callback != NULL) &&
-            (FD_ISSET(current->fd, &read_set) ||
-             FD_ISSET(current->fd, &except_set))) {
-          current->callback(i, current->group_id, current->callback_data);
-        }
-      }
-      if (FD_ISSET(ml_data.wakeup_read, &except_set)) {
-        fprintf(stderr, "mainloop caught exception on internal pipe\n");
-        ml_data.is_running = 0;
-        result = -EFAULT;
-        break;
-      }
-      if (FD_ISSET(ml_data.wakeup_read, &read_set)) {
-        char buf[10];
-        while (read(ml_data.wakeup_read, buf, sizeof(buf)) == sizeof(buf)) ;
-      }
-    }
-    else
-    if (ret < 0) {
-      /* error */
-      perror("mainloop caught error");
-      ml_data.is_running = 0;
-      result = ret;
+  while ((child = 2 * pos + 1) < ml->heap_used) {
+    if ((child + 1 < ml->heap_used) &&
+        heap_less(ml, ml->heap[child + 1], ml->heap[child]))
+      child++;
+    if (!heap_less(ml, ml->heap[child], index))
       break;
-    }
+    heap_set(ml, pos, ml->heap[child]);
+    pos = child;
+  }
+  heap_set(ml, pos, index);
+}
 
-    gettimeofday(&now, NULL);
-    
-    /* apply the minimum resolution */
-    now.tv_usec += TIMER_MIN_RESOLUTIN * 1000L;
-    if (now.tv_usec > 1000000L) {
-      now.tv_usec -= 1000000L;
-      now.tv_sec++;
+static int heap_insert(struct ml_data_s *ml, int index)
+{
+  if (ml->heap_used >= ml->heap_allocated) {
+    int *new_heap;
+    int new_size = (ml->heap_allocated) ? 2 * ml->heap_allocated :
+                                              INITIAL_EV_LIST_SIZE;
+    new_heap = realloc(ml->heap, new_size * sizeof(ml->heap[0]));
+    if (new_heap == NULL) {
+      fprintf(stderr, "Cannot extend size of timer heap\n");
+      return -ENOMEM;
     }
-
-    /* run callbacks for timer events (in correct order!) */
-    do {
-      index = -1;
-      tv.tv_sec = 0;
-      current = ml_data.ev_list;
-      for (i = 0; i < ml_data.ev_list_used; i++, current++) {
-        if (!current->processed &&
-            ((current->type == EV_TYPE_TIMER) ||
-             (current->type == EV_TYPE_PTIMER))) {
-          if (timercmp(&current->expire, &now, <=)) {
-            if ((tv.tv_sec == 0) ||
-                timercmp(&current->expire, &tv, <)) {
-              tv.tv_sec = current->expire.tv_sec;
-              tv.tv_usec = current->expire.tv_usec;
-              index = i;
-            }
-          }
-        }
-      }
-      if (index >= 0) {
-        current = &(ml_data.ev_list[index]);
-        current->processed = 1;
-        if (current->type == EV_TYPE_TIMER) {
-          /* remove timer */
-          current->type = EV_TYPE_EMPTY;
-          /* try to reduce the number of "used" entries */
-          if (index + 1 == ml_data.ev_list_used) {
-            for (i = index; i >= 0; i--) {
-              if (ml_data.ev_list[i].type != EV_TYPE_EMPTY)
-                break;
-              ml_data.ev_list_used--;
-            }
-          }
-        }
-        else {
-          /* reschedule timer */
-          timeradd(&current->expire, &current->interval, &current->expire);
-          /* TODO: What happens if we were suspended for a while? */
-        }
-        if (current->callback) {
-          current->callback(ml_data.ev_list[index].event_id,
-                            ml_data.ev_list[index].group_id,
-                            current->callback_data);
-        }
-      }
-    } while (index >= 0);
+    ml->heap = new_heap;
+    ml->heap_allocated = new_size;
   }
-  
-  if (result != 0)
-    yp_ml_shutdown();
-  
-  return result;
+  heap_set(ml, ml->heap_used++, index);
+  heap_sift_up(ml, ml->heap_used - 1);
+  return 0;
 }
 
-/*****************************************************************/
+static void heap_remove(struct ml_data_s *ml, int index)
+{
+  int pos = ml->ev_list[index].heap_pos;
+  int last;
 
-int yp_ml_stop()
+  if (pos < 0)
+    return;
+  ml->ev_list[index].heap_pos = -1;
+  last = ml->heap[--ml->heap_used];
+  if (pos == ml->heap_used)
+    return;
+  heap_set(ml, pos, last);
+  if ((pos > 0) && heap_less(ml, last, ml->heap[(pos - 1) / 2]))
+    heap_sift_up(ml, pos);
+  else
+    heap_sift_down(ml, pos);
+}
+
+/* Lowers 'deadline' to the latest time the timers in the subtree at 'pos'
+ * allow (expire + slack). A subtree whose root does not expire before the
+ * current deadline cannot lower it any further.
+ */
+static void heap_deadline(struct ml_data_s *ml, int pos,
+                          struct timeval *deadline)
 {
-  int is_running = ml_data.is_running;
-  ssize_t res;
+  struct event_list *entry;
+  struct timeval tv;
 
-  ml_data.is_running = 0;
-  if (is_running)
-    res = write(ml_data.wakeup_write, &is_running, 1);   /* wake up mainloop */
+  if (pos >= ml->heap_used)
+    return;
+  entry = &ml->ev_list[ml->heap[pos]];
+  if (!timercmp(&entry->expire, deadline, <))
+    return;
+  timeradd(&entry->expire, &entry->slack, &tv);
+  if (timercmp(&tv, deadline, <))
+    *deadline = tv;
+  heap_deadline(ml, 2 * pos + 1, deadline);
+  heap_deadline(ml, 2 * pos + 2, deadline);
+}
+
+static void entry_release(struct ml_data_s *ml, int index);
+
+/* Timers added during dispatch must not fire in the same run, so they
+ * are parked until the dispatch is done.
+ */
+static int pending_add(struct ml_data_s *ml, int index)
+{
+  if (ml->pending_used >= ml->pending_allocated) {
+    int *new_pending;
+    int new_size = (ml->pending_allocated) ?
+                   2 * ml->pending_allocated : INITIAL_EV_LIST_SIZE;
+    new_pending = realloc(ml->pending,
+                          new_size * sizeof(ml->pending[0]));
+    if (new_pending == NULL) {
+      fprintf(stderr, "Cannot extend size of pending timer list\n");
+      return -ENOMEM;
+    }
+    ml->pending = new_pending;
+    ml->pending_allocated = new_size;
+  }
+  ml->ev_list[index].processed = 1;
+  ml->pending[ml->pending_used++] = index;
   return 0;
 }
 
+static void pending_flush(struct ml_data_s *ml)
+{
+  struct event_list *entry;
+  int i, index;
+
+  for (i = 0; i < ml->pending_used; i++) {
+    index = ml->pending[i];
+    entry = &ml->ev_list[index];
+    /* skip removed timers and duplicates (slot reused meanwhile) */
+    if (entry->processed &&
+        ((entry->type == EV_TYPE_TIMER) || (entry->type == EV_TYPE_PTIMER) ||
+         (entry->type == EV_TYPE_ATIMER))) {
+      entry->processed = 0;
+      if (heap_insert(ml, index) != 0)
+        entry_release(ml, index);
+    }
+  }
+  ml->pending_used = 0;
+}
+
+static int timer_add(struct ml_data_s *ml, int index)
+{
+  if (ml->dispatching)
+    return pending_add(ml, index);
+  ml->ev_list[index].processed = 0;
+  return heap_insert(ml, index);
+}
+
 /*****************************************************************/
+/* event slots and groups                                        */
 
-int yp_ml_shutdown()
+static struct group_entry *group_lookup(struct ml_data_s *ml, int group_id,
+                                        int create)
 {
-  ml_data.is_running = 0;
+  struct group_entry *group;
+  unsigned int mask, pos;
 
-  if (ml_data.wakeup_write >= 0) {
-    close(ml_data.wakeup_write);
-    ml_data.wakeup_write = -1;
-  }
-  if (ml_data.wakeup_read >= 0) {
-    close(ml_data.wakeup_read);
-    ml_data.wakeup_read = -1;
+  if (create && (2 * (ml->groups_used + 1) > ml->groups_allocated)) {
+    /* rehash into a table of twice the size */
+    struct group_entry *old_groups = ml->groups;
+    int old_size = ml->groups_allocated;
+    int new_size = (old_size) ? 2 * old_size : INITIAL_GROUP_SIZE;
+    int i;
+
+    ml->groups = malloc(new_size * sizeof(ml->groups[0]));
+    if (ml->groups == NULL) {
+      fprintf(stderr, "Cannot extend size of group table\n");
+      ml->groups = old_groups;
+      return NULL;
+    }
+    for (i = 0; i < new_size; i++)
+      ml->groups[i].first = -1;
+    ml->groups_allocated = new_size;
+    mask = new_size - 1;
+    for (i = 0; i < old_size; i++) {
+      if (old_groups[i].first == -1)
+        continue;
+      pos = (unsigned int) old_groups[i].group_id & mask;
+      while (ml->groups[pos].first != -1)
+        pos = (pos + 1) & mask;
+      ml->groups[pos] = old_groups[i];
+    }
+    free(old_groups);
   }
+  if (ml->groups_allocated == 0)
+    return NULL;
 
-  /* Free memory */
-  ml_data.ev_list_allocated = 0;
-  ml_data.ev_list_used = 0;
-  if (ml_data.ev_list) {
-    free(ml_data.ev_list);
-    ml_data.ev_list = NULL;
+  mask = ml->groups_allocated - 1;
+  pos = (unsigned int) group_id & mask;
+  while ((group = &ml->groups[pos])->first != -1) {
+    if (group->group_id == group_id)
+      return group;
+    pos = (pos + 1) & mask;
   }
-  ml_data.event_id_max = 0;
-  FD_ZERO(&ml_data.select_master_set);
-  ml_data.select_max_fd = 0;
+  if (!create)
+    return NULL;
+  /* groups are never removed from the table, there are only a few */
+  group->group_id = group_id;
+  group->first = -2;      /* in use, but empty */
+  group->count = 0;
+  group->stats = NULL;
+  ml->groups_used++;
+  return group;
+}
 
-  return 0;
+static void group_link(struct ml_data_s *ml, int index)
+{
+  struct event_list *entry = &ml->ev_list[index];
+  struct group_entry *group = group_lookup(ml, entry->group_id, 1);
+
+  entry->group_prev = -1;
+  entry->group_next = -1;
+  if (group == NULL)
+    return;
+  if (group->first >= 0) {
+    entry->group_next = group->first;
+    ml->ev_list[group->first].group_prev = index;
+  }
+  group->first = index;
+  group->count++;
 }
 
-/*****************************************************************/
+static void group_unlink(struct ml_data_s *ml, int index)
+{
+  struct event_list *entry = &ml->ev_list[index];
+  struct group_entry *group = group_lookup(ml, entry->group_id, 0);
+
+  if (group == NULL)
+    return;
+  if (entry->group_prev >= 0)
+    ml->ev_list[entry->group_prev].group_next = entry->group_next;
+  else
+  if (group->first == index)
+    group->first = (entry->group_next >= 0) ? entry->group_next : -2;
+  else
+    return;               /* not linked */
+  if (entry->group_next >= 0)
+    ml->ev_list[entry->group_next].group_prev = entry->group_prev;
+  entry->group_prev = entry->group_next = -1;
+  group->count--;
+}
 
-struct event_list *get_free_entry(int *index)
+/* Extends the event list, all new slots go to the free list. */
+static int ev_list_grow(struct ml_data_s *ml)
 {
-  struct event_list *entry;
-  int i, idx;
-  
-  entry = NULL;
-  for (i = 0; i < ml_data.ev_list_used; i++) {
-    if (ml_data.ev_list[i].type == EV_TYPE_EMPTY) {
-      entry = &(ml_data.ev_list[i]);
-      idx = i;
-      break;
-    }
+  struct event_list *new_base;
+  int new_size, i;
+
+  new_size = (ml->ev_list_allocated) ? 2 * ml->ev_list_allocated :
+                                           INITIAL_EV_LIST_SIZE;
+  if (new_size > EV_SLOT_MASK + 1) {
+    fprintf(stderr, "Too many events in mainloop\n");
+    return -ENOMEM;
   }
-  if (entry == NULL) {
-    if (ml_data.ev_list_used >= ml_data.ev_list_allocated) {
-      struct event_list *new_base;
-      fprintf(stderr, "extending event list\n");
-      ml_data.ev_list_allocated += 3;        /* add 3 records (2 spare) */
-      new_base = realloc(ml_data.ev_list,
-                         ml_data.ev_list_allocated * sizeof(ml_data.ev_list[0]));
-      if (new_base == NULL) {
-        fprintf(stderr, "Cannot extend size of event list");
-        return NULL;
-      }
-      ml_data.ev_list = new_base;
-    }
-    idx = ml_data.ev_list_used++;
-    entry = &(ml_data.ev_list[idx]);
+  new_base = realloc(ml->ev_list, new_size * sizeof(ml->ev_list[0]));
+  if (new_base == NULL) {
+    fprintf(stderr, "Cannot extend size of event list\n");
+    return -ENOMEM;
+  }
+  ml->ev_list = new_base;
+  for (i = new_size - 1; i >= ml->ev_list_allocated; i--) {
+    memset(&ml->ev_list[i], 0, sizeof(ml->ev_list[i]));
+    ml->ev_list[i].type = EV_TYPE_EMPTY;
+    ml->ev_list[i].generation = 1;
+    ml->ev_list[i].heap_pos = -1;
+    ml->ev_list[i].group_prev = -1;
+    ml->ev_list[i].group_next = -1;
+    ml->ev_list[i].next_free = ml->free_head;
+    ml->free_head = i;
   }
+  ml->ev_list_allocated = new_size;
+  return 0;
+}
+
+/* Takes a slot from the free list and assigns a new event id to it. */
+static struct event_list *entry_alloc(struct ml_data_s *ml, int type,
+                                      int group_id, int *index)
+{
+  struct event_list *entry;
+  int idx;
+
+  if ((ml->free_head < 0) && (ev_list_grow(ml) != 0))
+    return NULL;
+  idx = ml->free_head;
+  entry = &ml->ev_list[idx];
+  ml->free_head = entry->next_free;
+
+  entry->type = type;
+  entry->event_id = EV_MAKE_ID(idx, entry->generation);
+  entry->group_id = group_id;
+  entry->heap_pos = -1;
+  entry->processed = 0;
+  entry->fd = -1;
+  entry->priority = ml->default_priority;
+  group_link(ml, idx);
   if (index)
     *index = idx;
   return entry;
 }
 
-/*****************************************************************/
+/* Returns the slot index of a valid event id or -1. */
+static inline int entry_lookup(struct ml_data_s *ml, int event_id)
+{
+  int idx;
 
-/* Returns the number of periods of tm_check until the timers
- * overlap.
- * 0 .. there is no (reasonable) overlap detected.
- * 1 .. a perfect match, every tick overlaps with tm_exist
- * >1 .. every X ticks overlap.
+  if (event_id < 0)
+    return -1;
+  idx = EV_ID_SLOT(event_id);
+  if ((idx >= ml->ev_list_allocated) ||
+      (ml->ev_list[idx].type == EV_TYPE_EMPTY) ||
+      (ml->ev_list[idx].event_id != event_id))
+    return -1;
+  return idx;
+}
+
+/* Frees an entry, removes it from the heap (if it is a timer) and its
+ * group. The callback related fields stay valid until the slot is reused.
  */
-static inline int timer_overlap_score(int tm_check,
-                                      struct timeval *tv_exist)
+static void entry_release(struct ml_data_s *ml, int index)
 {
-  int tm_exist = TIMEVAL_TO_MS(tv_exist);
-  int i;
-  if (!tm_check || !tm_exist) {
-    /* invalid durations */
-    return 0;
+  struct event_list *entry = &ml->ev_list[index];
+
+  heap_remove(ml, index);
+  group_unlink(ml, index);
+  entry->type = EV_TYPE_EMPTY;
+  entry->processed = 0;
+  entry->generation = (entry->generation % EV_GEN_MASK) + 1;
+  entry->next_free = ml->free_head;
+  ml->free_head = index;
+}
+
+/*****************************************************************/
+/* select backend (fallback)                                     */
+
+static int select_init(struct ml_data_s *ml)
+{
+  FD_ZERO(&ml->select_master_set);
+  ml->select_max_fd = 0;
+  return 0;
+}
+
+static void select_shutdown(struct ml_data_s *ml)
+{
+  FD_ZERO(&ml->select_master_set);
+  ml->select_max_fd = 0;
+}
+
+static int select_add_fd(struct ml_data_s *ml, int fd, int index, int event_id)
+{
+  (void) index;
+  (void) event_id;
+
+  if (fd >= FD_SETSIZE) {
+    fprintf(stderr, "fd %d exceeds FD_SETSIZE\n", fd);
+    return -EINVAL;
   }
-  if (tm_check == tm_exist) {
-    /* same interval */
-    return 1;
+  /* like epoll, an fd can be registered once only */
+  if (FD_ISSET(fd, &ml->select_master_set))
+    return -EEXIST;
+  FD_SET(fd, &ml->select_master_set);
+  if (ml->select_max_fd <= fd)
+    ml->select_max_fd = fd + 1;
+  return 0;
+}
+
+static int select_del_fd(struct ml_data_s *ml, int fd)
+{
+  /* 'select_max_fd' is not shrunk, 'select' does not care */
+  if (fd < FD_SETSIZE)
+    FD_CLR(fd, &ml->select_master_set);
+  return 0;
+}
+
+static int select_wait(struct ml_data_s *ml, int timeout,
+                       struct ready_event *ready, int max_ready)
+{
+  struct event_list *current;
+  fd_set read_set;
+  fd_set except_set;
+  struct timeval tv;
+  int ret, i, num;
+
+  MS_TO_TIMEVAL(timeout, &tv);
+  memcpy(&read_set, &ml->select_master_set, sizeof(fd_set));
+  memcpy(&except_set, &ml->select_master_set, sizeof(fd_set));
+
+  ret = select(ml->select_max_fd, &read_set, NULL, &except_set, &tv);
+  if (ret <= 0)
+    return (ret < 0) ? -errno : 0;
+
+  num = 0;
+  if (FD_ISSET(ml->wakeup_read, &read_set) ||
+      FD_ISSET(ml->wakeup_read, &except_set)) {
+    ready[num].index = READY_WAKEUP;
+    ready[num].event_id = 0;
+    ready[num].error = FD_ISSET(ml->wakeup_read, &except_set);
+    num++;
   }
-  if (tm_exist > tm_check) {
-    for (i = 1; i <= 4; i++)
-      if ((tm_exist * i) % tm_check == 0)
-        return (tm_exist * i) / tm_check;
+  if ((ml->sig_read >= 0) && FD_ISSET(ml->sig_read, &read_set)) {
+    ready[num].index = READY_SIGNAL;
+    ready[num].event_id = 0;
+    ready[num].error = 0;
+    num++;
   }
-  else {  /* tm_exist < tm_check */
-    for (i = 1; i <= 4; i++)
-      if ((tm_check * i) % tm_exist == 0)
-        return i;
+  if ((ml->clock_fd >= 0) && FD_ISSET(ml->clock_fd, &read_set)) {
+    ready[num].index = READY_CLOCK;
+    ready[num].event_id = 0;
+    ready[num].error = 0;
+    num++;
   }
-  return 0;
+  /* select cannot tell us which events are ready, so look them up */
+  current = ml->ev_list;
+  for (i = 0; (i < ml->ev_list_allocated) && (num < max_ready);
+       i++, current++) {
+    if ((current->type == EV_TYPE_IO) &&
+        (FD_ISSET(current->fd, &read_set) ||
+         FD_ISSET(current->fd, &except_set))) {
+      ready[num].index = i;
+      ready[num].event_id = current->event_id;
+      ready[num].error = 0;
+      num++;
+    }
+  }
+  return num;
 }
 
+static const struct ml_backend select_backend = {
+  name:     "select",
+  init:     select_init,
+  shutdown: select_shutdown,
+  add_fd:   select_add_fd,
+  del_fd:   select_del_fd,
+  wait:     select_wait
+};
+
 /*****************************************************************/
+/* epoll backend (Linux)                                         */
 
-static int yp_mlint_schedule_timer(int group_id, int delay,
-                                   int allow_optimize,
-                                   yp_ml_callback cb, void *private_data,
-                                   enum event_type type)
+#ifdef HAVE_SYS_EPOLL_H
+
+static int epoll_init(struct ml_data_s *ml)
+{
+  ml->epoll_fd = epoll_create(INITIAL_EV_LIST_SIZE);
+  if (ml->epoll_fd < 0)
+    return (errno > 0) ? -errno : -1;
+  fcntl(ml->epoll_fd, F_SETFD, FD_CLOEXEC);
+  return 0;
+}
+
+static void epoll_shutdown(struct ml_data_s *ml)
+{
+  if (ml->epoll_fd >= 0) {
+    close(ml->epoll_fd);
+    ml->epoll_fd = -1;
+  }
+}
+
+static int epoll_add_fd(struct ml_data_s *ml, int fd, int index, int event_id)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLPRI;
+  /* keep the event id to detect stale notifications */
+  ev.data.u64 = ((uint64_t) (uint32_t) event_id << 32) | (uint32_t) index;
+  if (epoll_ctl(ml->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    /* EEXIST for an fd which is watched already is the caller's error */
+    if (errno != EEXIST)
+      perror("epoll_ctl(ADD)");
+    return (errno > 0) ? -errno : -1;
+  }
+  return 0;
+}
+
+static int epoll_del_fd(struct ml_data_s *ml, int fd)
+{
+  struct epoll_event ev;     /* needed by kernels < 2.6.9 */
+
+  if (epoll_ctl(ml->epoll_fd, EPOLL_CTL_DEL, fd, &ev) < 0)
+    return (errno > 0) ? -errno : -1;
+  return 0;
+}
+
+static int epoll_wait_ready(struct ml_data_s *ml, int timeout,
+                            struct ready_event *ready, int max_ready)
+{
+  struct epoll_event events[MAX_READY_EVENTS];
+  int ret, i;
+
+  if (max_ready > MAX_READY_EVENTS)
+    max_ready = MAX_READY_EVENTS;
+  ret = epoll_wait(ml->epoll_fd, events, max_ready, timeout);
+  if (ret < 0)
+    return -errno;
+
+  for (i = 0; i < ret; i++) {
+    ready[i].index = (int) (uint32_t) events[i].data.u64;
+    ready[i].event_id = (int) (uint32_t) (events[i].data.u64 >> 32);
+    ready[i].error = (ready[i].index == READY_WAKEUP) &&
+                     (events[i].events & (EPOLLERR | EPOLLHUP));
+  }
+  return ret;
+}
+
+static const struct ml_backend epoll_backend = {
+  name:     "epoll",
+  init:     epoll_init,
+  shutdown: epoll_shutdown,
+  add_fd:   epoll_add_fd,
+  del_fd:   epoll_del_fd,
+  wait:     epoll_wait_ready
+};
+
+#endif
+
+/* available backends, the first one is the default */
+static const struct ml_backend *ml_backends[] = {
+#ifdef HAVE_SYS_EPOLL_H
+  &epoll_backend,
+#endif
+  &select_backend,
+  NULL
+};
+
+static const char *ml_backend_name = NULL;
+
+/*****************************************************************/
+
+int yp_ml_select_backend(const char *name)
+{
+  int i;
+
+  if (ml_default.backend) {
+    fprintf(stderr, "Cannot select a backend after yp_ml_init\n");
+    return -EBUSY;
+  }
+  if (name) {
+    for (i = 0; ml_backends[i]; i++)
+      if (!strcmp(ml_backends[i]->name, name))
+        break;
+    if (!ml_backends[i]) {
+      fprintf(stderr, "Unknown mainloop backend '%s'\n", name);
+      return -ENOENT;
+    }
+  }
+  ml_backend_name = name;
+  return 0;
+}
+
+/*****************************************************************/
+
+static void ml_wakeup(struct ml_data_s *ml)
 {
-  struct event_list *entry;
-  struct timeval now;
-  int index, i;
-  int score, best_score, best_index;
   ssize_t res;
-  
-  entry = get_free_entry(&index);
-  if (entry == NULL)
+#ifdef HAVE_SYS_EVENTFD_H
+  uint64_t one = 1;
+
+  if (ml->wakeup_read == ml->wakeup_write) {
+    res = write(ml->wakeup_write, &one, sizeof(one));
+    return;
+  }
+#endif
+  res = write(ml->wakeup_write, "", 1);
+}
+
+static void ml_drain_wakeup(struct ml_data_s *ml)
+{
+  char buf[10];
+  ssize_t res;
+
+#ifdef HAVE_SYS_EVENTFD_H
+  if (ml->wakeup_read == ml->wakeup_write) {
+    uint64_t count;
+    res = read(ml->wakeup_read, &count, sizeof(count));
+    return;
+  }
+#endif
+  while (read(ml->wakeup_read, buf, sizeof(buf)) == sizeof(buf)) ;
+}
+
+/* Wakes up the mainloop unless a wakeup is already outstanding. Safe to
+ * be called from any thread and from signal handlers.
+ */
+static void ml_signal(struct ml_data_s *ml)
+{
+  if (__sync_bool_compare_and_swap(&ml->wakeup_signalled, 0, 1))
+    ml_wakeup(ml);
+  else
+    __sync_fetch_and_add(&ml->stats.wakeups_avoided, 1);
+}
+
+/* Called after the events were changed. The loop thread itself does not
+ * need a wakeup as it calculates its timeout after dispatching.
+ */
+static void ml_notify(struct ml_data_s *ml)
+{
+  if (yp_mlc_same_thread(ml))
+    __sync_fetch_and_add(&ml->stats.wakeups_avoided, 1);
+  else
+    ml_signal(ml);
+}
+
+/*****************************************************************/
+
+static int ml_wakeup_open(struct ml_data_s *ml)
+{
+  int fd[2];
+
+#ifdef HAVE_SYS_EVENTFD_H
+  fd[0] = eventfd(0, 0);
+  if (fd[0] >= 0) {
+    fcntl(fd[0], F_SETFL, O_NONBLOCK);
+    ml->wakeup_read = ml->wakeup_write = fd[0];
+    return 0;
+  }
+#endif
+  if (pipe(fd) != 0) {
+    perror("Cannot create internal pipe");
+    return -errno;
+  }
+  fcntl(fd[0], F_SETFL, O_NONBLOCK);
+  ml->wakeup_read = fd[0];
+  ml->wakeup_write = fd[1];
+  return 0;
+}
+
+static void ml_wakeup_close(struct ml_data_s *ml)
+{
+  if ((ml->wakeup_write >= 0) &&
+      (ml->wakeup_write != ml->wakeup_read)) {
+    close(ml->wakeup_write);
+  }
+  if (ml->wakeup_read >= 0)
+    close(ml->wakeup_read);
+  ml->wakeup_read = ml->wakeup_write = -1;
+}
+
+/*****************************************************************/
+
+static void task_push(struct ml_data_s *ml, struct ml_task *task)
+{
+  struct ml_task *prev;
+
+  task->next = NULL;
+  do {
+    prev = ml->tasks.head;
+  } while (!__sync_bool_compare_and_swap(&ml->tasks.head, prev, task));
+  /* the queue is broken for the consumer until this store is visible */
+  prev->next = task;
+}
+
+/* Returns the oldest task or NULL if the queue is empty. */
+static struct ml_task *task_pop(struct ml_data_s *ml)
+{
+  struct ml_task_queue *q = &ml->tasks;
+  struct ml_task *tail = q->tail;
+  struct ml_task *next = tail->next;
+
+  if (tail == &q->stub) {
+    if (next == NULL)
+      return NULL;
+    q->tail = next;
+    tail = next;
+    next = next->next;
+  }
+  if (next) {
+    __sync_synchronize();
+    q->tail = next;
+    return tail;
+  }
+  if (tail != q->head) {
+    /* a producer was interrupted while linking its task, it is dequeued
+       in the next iteration */
+    return NULL;
+  }
+  /* last element, put the stub behind it so it can be dequeued */
+  task_push(ml, &q->stub);
+  next = tail->next;
+  if (next) {
+    __sync_synchronize();
+    q->tail = next;
+    return tail;
+  }
+  /* another producer came in between */
+  return NULL;
+}
+
+static void task_queue_init(struct ml_data_s *ml)
+{
+  ml->tasks.stub.next = NULL;
+  ml->tasks.head = &ml->tasks.stub;
+  ml->tasks.tail = &ml->tasks.stub;
+}
+
+/* Runs the posted tasks and returns their number, but not more than
+ * MAX_POSTED_TASKS in a row so that a task posting itself cannot starve
+ * the other events.
+ */
+static int task_queue_run(struct ml_data_s *ml)
+{
+  struct ml_task *task;
+  int count;
+
+  for (count = 0; count < MAX_POSTED_TASKS; count++) {
+    task = task_pop(ml);
+    if (task == NULL) {
+      /* make sure that a task which could not be dequeued yet is run
+         in the next iteration */
+      if (ml->tasks.head != ml->tasks.tail)
+        ml_signal(ml);
+      return count;
+    }
+    task->callback(task->callback_data);
+    free(task);
+  }
+  ml_signal(ml);
+  return count;
+}
+
+static void task_queue_free(struct ml_data_s *ml)
+{
+  struct ml_task *task;
+
+  if (ml->tasks.tail == NULL)
+    return;
+  while ((task = task_pop(ml)) != NULL)
+    free(task);
+}
+
+/*****************************************************************/
+
+/* used by the self-pipe fallback only */
+static struct ml_data_s *sig_owner[NSIG];
+static struct sigaction sig_saved[NSIG];
+
+static void signal_handler(int signum)
+{
+  struct ml_data_s *ml = sig_owner[signum];
+  unsigned char c = signum;
+  int saved_errno = errno;
+  ssize_t res;
+
+  if (ml && (ml->sig_write >= 0))
+    res = write(ml->sig_write, &c, 1);
+  errno = saved_errno;
+}
+
+static int signal_open(struct ml_data_s *ml)
+{
+  int fd[2];
+  int ret;
+
+  sigemptyset(&ml->sig_mask);
+#ifdef HAVE_SYS_SIGNALFD_H
+  fd[0] = signalfd(-1, &ml->sig_mask, 0);
+  if (fd[0] >= 0) {
+    fd[1] = -1;
+  }
+  else
+#endif
+  if (pipe(fd) != 0) {
+    perror("Cannot create signal pipe");
+    return -errno;
+  }
+  else {
+    fcntl(fd[1], F_SETFL, O_NONBLOCK);
+  }
+  fcntl(fd[0], F_SETFL, O_NONBLOCK);
+
+  ret = ml->backend->add_fd(ml, fd[0], READY_SIGNAL, 0);
+  if (ret != 0) {
+    close(fd[0]);
+    if (fd[1] >= 0)
+      close(fd[1]);
+    return ret;
+  }
+  ml->sig_read = fd[0];
+  ml->sig_write = fd[1];
+  return 0;
+}
+
+static void signal_watch(struct ml_data_s *ml, int signum)
+{
+  struct sigaction sa;
+  sigset_t set;
+
+  sigaddset(&ml->sig_mask, signum);
+  if (ml->sig_write < 0) {
+#ifdef HAVE_SYS_SIGNALFD_H
+    /* blocked signals are only reported by the signalfd */
+    sigemptyset(&set);
+    sigaddset(&set, signum);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    signalfd(ml->sig_read, &ml->sig_mask, 0);
+#endif
+  }
+  else {
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = signal_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sig_owner[signum] = ml;
+    sigaction(signum, &sa, &sig_saved[signum]);
+  }
+}
+
+/* restores the original handling of a signal */
+static void signal_restore(struct ml_data_s *ml, int signum)
+{
+  sigset_t set;
+
+  sigdelset(&ml->sig_mask, signum);
+  if (ml->sig_write < 0) {
+#ifdef HAVE_SYS_SIGNALFD_H
+    signalfd(ml->sig_read, &ml->sig_mask, 0);
+    sigemptyset(&set);
+    sigaddset(&set, signum);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+#endif
+  }
+  else {
+    sigaction(signum, &sig_saved[signum], NULL);
+    sig_owner[signum] = NULL;
+  }
+}
+
+static void signal_unwatch(struct ml_data_s *ml, int signum)
+{
+  int i;
+
+  /* another watcher for the same signal? */
+  for (i = 0; i < ml->ev_list_allocated; i++) {
+    if ((ml->ev_list[i].type == EV_TYPE_SIGNAL) &&
+        (ml->ev_list[i].fd == signum))
+      return;
+  }
+  signal_restore(ml, signum);
+}
+
+/* Returns the number of the next signal received or 0. */
+static int signal_read(struct ml_data_s *ml)
+{
+  unsigned char c;
+
+#ifdef HAVE_SYS_SIGNALFD_H
+  if (ml->sig_write < 0) {
+    struct signalfd_siginfo info;
+
+    if (read(ml->sig_read, &info, sizeof(info)) != sizeof(info))
+      return 0;
+    return info.ssi_signo;
+  }
+#endif
+  if (read(ml->sig_read, &c, 1) != 1)
+    return 0;
+  return c;
+}
+
+static void signal_close(struct ml_data_s *ml)
+{
+  int signum;
+
+  if (ml->sig_read < 0)
+    return;
+  for (signum = 1; signum < NSIG; signum++) {
+    if (sigismember(&ml->sig_mask, signum) == 1)
+      signal_restore(ml, signum);
+  }
+  ml->backend->del_fd(ml, ml->sig_read);
+  close(ml->sig_read);
+  if (ml->sig_write >= 0)
+    close(ml->sig_write);
+  ml->sig_read = ml->sig_write = -1;
+}
+
+/*****************************************************************/
+/* wall clock aligned timers                                     */
+
+/* Sets the expiry of an aligned timer to just after the next multiple of
+ * its interval in wall clock time. Multiples are counted from the epoch,
+ * so seconds and minutes are also aligned in the local time zone. The
+ * minimum resolution is added as the loop runs timers up to that much
+ * early. 'after_tick' skips a boundary which is too close, it would
+ * otherwise fire twice for the same one.
+ */
+static void atimer_align(struct ml_data_s *ml, struct event_list *entry,
+                         int after_tick)
+{
+  struct timeval now, wall, tv;
+  long long period, delay;
+
+  ml_get_time(&now);
+  gettimeofday(&wall, NULL);
+  period = TIMEVAL_TO_MS(&entry->interval) * 1000LL;
+  delay = period -
+          ((long long) wall.tv_sec * 1000000LL + wall.tv_usec) % period;
+  if (after_tick && (delay < TIMER_MIN_RESOLUTIN * 1000LL))
+    delay += period;
+  delay += TIMER_MIN_RESOLUTIN * 1000LL;
+  tv.tv_sec = delay / 1000000;
+  tv.tv_usec = delay % 1000000;
+  timeradd(&now, &tv, &entry->expire);
+}
+
+#if defined(HAVE_SYS_TIMERFD_H) && defined(TFD_TIMER_CANCEL_ON_SET)
+static int clock_watch_arm(struct ml_data_s *ml)
+{
+  struct itimerspec its;
+
+  /* the expiry does not matter, only its cancellation when the time is
+   * set, so keep it far in the future */
+  memset(&its, 0, sizeof(its));
+  clock_gettime(CLOCK_REALTIME, &its.it_value);
+  its.it_value.tv_sec += 24 * 3600;
+  return timerfd_settime(ml->clock_fd,
+                         TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+                         &its, NULL);
+}
+#endif
+
+/* Opens a timerfd which becomes readable when the system time is set, if
+ * supported. Without it aligned timers only realign when they run.
+ */
+static void clock_watch_open(struct ml_data_s *ml)
+{
+#if defined(HAVE_SYS_TIMERFD_H) && defined(TFD_TIMER_CANCEL_ON_SET)
+  if (ml->clock_fd >= 0)
+    return;
+  ml->clock_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK);
+  if (ml->clock_fd < 0)
+    return;
+  if ((clock_watch_arm(ml) < 0) ||
+      (ml->backend->add_fd(ml, ml->clock_fd, READY_CLOCK, 0) != 0)) {
+    close(ml->clock_fd);
+    ml->clock_fd = -1;
+  }
+#endif
+}
+
+/* The clock watch became readable. Only if the system time was set, the
+ * read fails with ECANCELED; then all aligned timers run right away and
+ * align to the new time when rescheduled after running.
+ */
+static void clock_changed(struct ml_data_s *ml)
+{
+  struct event_list *entry;
+  int i;
+#if defined(HAVE_SYS_TIMERFD_H) && defined(TFD_TIMER_CANCEL_ON_SET)
+  uint64_t expirations;
+
+  if (read(ml->clock_fd, &expirations, sizeof(expirations)) >= 0) {
+    /* it merely expired, the time was not set */
+    clock_watch_arm(ml);
+    return;
+  }
+  if (errno != ECANCELED)
+    return;
+  clock_watch_arm(ml);
+#endif
+
+  for (i = 0; i < ml->ev_list_allocated; i++) {
+    entry = &ml->ev_list[i];
+    if (entry->type != EV_TYPE_ATIMER)
+      continue;
+    ml_get_time(&entry->expire);
+    if (entry->heap_pos >= 0) {
+      heap_remove(ml, i);
+      heap_insert(ml, i);
+    }
+  }
+}
+
+static void clock_watch_close(struct ml_data_s *ml)
+{
+  if (ml->clock_fd < 0)
+    return;
+  ml->backend->del_fd(ml, ml->clock_fd);
+  close(ml->clock_fd);
+  ml->clock_fd = -1;
+}
+
+/*****************************************************************/
+
+static int ml_init(struct ml_data_s *ml)
+{
+  int ret = 0;
+  int i;
+
+  /*if (ml->is_running) {
+    fprintf(stderr, "Cannot call yp_ml_init while mainloop is running\n");
+    abort();
+  }*/
+
+  memset(ml, 0, sizeof(*ml));
+  ml->epoll_fd = -1;
+  ml->sig_read = ml->sig_write = -1;
+  ml->clock_fd = -1;
+  ml->current_event = -1;
+  ml->default_priority = YP_ML_PRIO_TELEPHONY;
+  task_queue_init(ml);
+
+  /* preallocate event list */
+  ml->free_head = -1;
+  if (ev_list_grow(ml) != 0) {
+    fprintf(stderr, "Cannot allocate memory for event list\n");
     return -ENOMEM;
+  }
+
+  ret = ml_wakeup_open(ml);
+  if (ret != 0) {
+    free(ml->ev_list);
+    ml->ev_list = NULL;
+    ml->ev_list_allocated = 0;
+    return ret;
+  }
+  
+  /* set up the io backend, fall back to the next one on failure */
+  for (i = 0; ml_backends[i]; i++) {
+    if (ml_backend_name && strcmp(ml_backends[i]->name, ml_backend_name))
+      continue;
+    ret = ml_backends[i]->init(ml);
+    if (ret == 0) {
+      ret = ml_backends[i]->add_fd(ml, ml->wakeup_read, READY_WAKEUP, 0);
+      if (ret == 0)
+        break;
+      ml_backends[i]->shutdown(ml);
+    }
+    fprintf(stderr, "Cannot initialize mainloop backend %s\n",
+            ml_backends[i]->name);
+    if (ml_backend_name)
+      break;
+  }
+  if (!ml_backends[i] || (ret != 0)) {
+    ml_wakeup_close(ml);
+    free(ml->ev_list);
+    ml->ev_list = NULL;
+    ml->ev_list_allocated = 0;
+    return (ret != 0) ? ret : -ENOENT;
+  }
+  ml->backend = ml_backends[i];
+  
+  return 0;
+}
+
+/*****************************************************************/
+
+static void hist_add(struct ml_hist *hist, struct timeval *tv)
+{
+  unsigned long us = tv->tv_sec * 1000000UL + tv->tv_usec;
+  int i = 0;
+
+  while (((us >> i) > 1) && (i < ML_HIST_BUCKETS - 1))
+    i++;
+  hist->bucket[i]++;
+  hist->count++;
+  hist->total += us;
+  if (us > hist->max)
+    hist->max = us;
+}
+
+/* Runs the callback of an event. With profiling enabled its run time and
+ * (for timers) the delay against the expiry 'expire' are recorded for the
+ * event's group.
+ */
+static void ml_dispatch(struct ml_data_s *ml, struct event_list *entry,
+                        struct timeval *expire)
+{
+  int group_id = entry->group_id;
+  struct group_entry *group;
+  struct timeval start, end, tv;
+
+  if (entry->callback == NULL)
+    return;
+  if (!ml->profiling) {
+    entry->callback(entry->event_id, group_id, entry->callback_data);
+    return;
+  }
+
+  ml_get_time(&start);
+  entry->callback(entry->event_id, group_id, entry->callback_data);
+  ml_get_time(&end);
+
+  /* the callback may have changed the group table */
+  group = group_lookup(ml, group_id, 1);
+  if (group == NULL)
+    return;
+  if (group->stats == NULL) {
+    group->stats = calloc(1, sizeof(*group->stats));
+    if (group->stats == NULL)
+      return;
+  }
+  timersub(&end, &start, &tv);
+  hist_add(&group->stats->run, &tv);
+  if (expire) {
+    if (timercmp(&start, expire, >))
+      timersub(&start, expire, &tv);
+    else
+      timerclear(&tv);
+    hist_add(&group->stats->late, &tv);
+  }
+}
+
+static void ml_dump_to_file(struct ml_data_s *ml)
+{
+  FILE *f = stderr;
+
+  if (ml->stats_file) {
+    f = fopen(ml->stats_file, "w");
+    if (f == NULL) {
+      perror("Cannot open mainloop stats file");
+      f = stderr;
+    }
+  }
+  yp_mlc_dump_stats(ml, f);
+  if (f != stderr)
+    fclose(f);
+}
+
+/*****************************************************************/
+
+/* Runs the deferred callbacks which are due. If the loop is 'quiet' (ie.
+ * there was nothing else to do in this iteration) all of them are run,
+ * otherwise only those whose deadline has passed. Callbacks deferred in
+ * the meantime wait for the next iteration.
+ */
+static void idle_run(struct ml_data_s *ml, int quiet)
+{
+  struct event_list *entry;
+  struct timeval now;
+  int n = ml->idle_used;
+  int i, kept, index;
+
+  ml_get_time(&now);
+  kept = 0;
+  for (i = 0; i < n; i++) {
+    index = entry_lookup(ml, ml->idle[i]);
+    if ((index < 0) || (ml->ev_list[index].type != EV_TYPE_IDLE))
+      continue;
+    entry = &ml->ev_list[index];
+    if (quiet ||
+        (timerisset(&entry->expire) && !timercmp(&entry->expire, &now, >))) {
+      entry_release(ml, index);
+      ml_dispatch(ml, entry, NULL);
+    }
+    else {
+      ml->idle[kept++] = ml->idle[i];
+    }
+  }
+  /* keep the callbacks deferred by the ones which have just run */
+  memmove(&ml->idle[kept], &ml->idle[n],
+          (ml->idle_used - n) * sizeof(ml->idle[0]));
+  ml->idle_used -= n - kept;
+}
+
+/* Returns how long [ms] the loop may wait for events with deferred
+ * callbacks pending, at most 'timeout'. A wait which only checks whether
+ * the loop is quiet is followed by one which sleeps until the earliest
+ * deadline (or the next timer), so a busy loop does not poll.
+ */
+static int idle_timeout(struct ml_data_s *ml, int timeout)
+{
+  struct event_list *entry;
+  struct timeval now, tv;
+  int i, index, ms;
+
+  ml->idle_checked = !ml->idle_checked;
+  if (ml->idle_checked)
+    return 0;
+  ml_get_time(&now);
+  for (i = 0; i < ml->idle_used; i++) {
+    index = entry_lookup(ml, ml->idle[i]);
+    if ((index < 0) || (ml->ev_list[index].type != EV_TYPE_IDLE))
+      continue;
+    entry = &ml->ev_list[index];
+    if (!timerisset(&entry->expire))
+      return 0;                       /* no deadline, keep checking */
+    timersub(&entry->expire, &now, &tv);
+    if (tv.tv_sec < 0)
+      return 0;
+    ms = TIMEVAL_TO_MS(&tv) + ((tv.tv_usec % 1000) ? 1 : 0);
+    if (ms < timeout)
+      timeout = ms;
+  }
+  return timeout;
+}
+
+/*****************************************************************/
+
+static void signal_dispatch(struct ml_data_s *ml)
+{
+  int signum, i;
+
+  while ((signum = signal_read(ml)) > 0) {
+    /* callbacks may add or remove watchers, so look up every slot */
+    for (i = 0; i < ml->ev_list_allocated; i++) {
+      if ((ml->ev_list[i].type == EV_TYPE_SIGNAL) &&
+          (ml->ev_list[i].fd == signum))
+        ml_dispatch(ml, &ml->ev_list[i], NULL);
+    }
+  }
+}
+
+/*****************************************************************/
+
+/* Called for a periodic timer whose next expiry is already set. If the
+ * loop was blocked (or the system suspended) for longer than an interval
+ * the ticks which are overdue are counted and handled according to the
+ * timer's catch-up policy.
+ */
+static void timer_catch_up(struct ml_data_s *ml, struct event_list *entry,
+                           struct timeval *now)
+{
+  struct timeval tv_diff;
+  long long diff, interval, missed;
+
+  if (timercmp(&entry->expire, now, >))
+    return;
+  interval = TIMEVAL_TO_MS(&entry->interval);
+  if (interval <= 0)
+    return;
+  timersub(now, &entry->expire, &tv_diff);
+  diff = (long long) tv_diff.tv_sec * 1000LL + tv_diff.tv_usec / 1000;
+  missed = diff / interval + 1;
+  ml->stats.missed_ticks += missed;
+
+  switch (entry->catchup) {
+    case YP_ML_CATCHUP_COALESCE:
+      /* stay in phase, the current run covers all missed ticks */
+      MS_TO_TIMEVAL(missed * interval, &tv_diff);
+      timeradd(&entry->expire, &tv_diff, &entry->expire);
+      break;
+    case YP_ML_CATCHUP_SKIP:
+      /* start a new period right now */
+      timeradd(now, &entry->interval, &entry->expire);
+      break;
+    case YP_ML_CATCHUP_REPLAY:
+      /* fire once per iteration until we are back in time */
+      break;
+  }
+}
 
-  entry->type = type;
-  entry->event_id = ++ml_data.event_id_max;
-  entry->group_id = group_id;
-  entry->processed = 1;
-  MS_TO_TIMEVAL(delay, &entry->interval);
-  entry->fd = 0;
-  entry->callback = cb;
-  entry->callback_data = private_data;
-  
-  gettimeofday(&now, NULL);
+/*****************************************************************/
 
-  best_index = -1;
-  if (allow_optimize) {
-    for (i = 0; i < ml_data.ev_list_used; i++) {
-      if (i == index)
+static int run_add(struct ml_data_s *ml, int index, struct timeval *fired)
+{
+  struct ml_run_item *item;
+
+  if (ml->run_used >= ml->run_allocated) {
+    struct ml_run_item *new_run;
+    int new_size = (ml->run_allocated) ?
+                   2 * ml->run_allocated : MAX_READY_EVENTS;
+    new_run = realloc(ml->run, new_size * sizeof(ml->run[0]));
+    if (new_run == NULL) {
+      fprintf(stderr, "Cannot extend size of dispatch list\n");
+      return -ENOMEM;
+    }
+    ml->run = new_run;
+    ml->run_allocated = new_size;
+  }
+  item = &ml->run[ml->run_used++];
+  item->index = index;
+  item->event_id = ml->ev_list[index].event_id;
+  item->priority = ml->ev_list[index].priority;
+  if (fired)
+    item->fired = *fired;
+  else
+    timerclear(&item->fired);
+  return 0;
+}
+
+/* Runs a collected event unless a callback of a higher priority removed
+ * it in the meantime. A timer rescheduled in the meantime does not fire
+ * for its old expiry but goes back to the heap.
+ */
+static void run_item(struct ml_data_s *ml, struct ml_run_item *item,
+                     struct timeval *now)
+{
+  struct event_list *entry;
+  int index;
+
+  index = entry_lookup(ml, item->event_id);
+  if (index < 0)
+    return;
+  entry = &ml->ev_list[index];
+  if (entry->type == EV_TYPE_IO) {
+    ml_dispatch(ml, entry, NULL);
+    return;
+  }
+  if ((entry->type != EV_TYPE_TIMER) && (entry->type != EV_TYPE_PTIMER) &&
+      (entry->type != EV_TYPE_ATIMER))
+    return;
+  if (timercmp(&entry->expire, &item->fired, !=)) {
+    pending_add(ml, index);
+    return;
+  }
+
+  if (entry->type == EV_TYPE_TIMER) {
+    /* remove timer */
+    entry_release(ml, index);
+  }
+  else if (entry->type == EV_TYPE_ATIMER) {
+    /* realign timer, no catch-up for missed ticks needed */
+    atimer_align(ml, entry, 1);
+    pending_add(ml, index);
+  }
+  else {
+    /* reschedule timer */
+    timeradd(&entry->expire, &entry->interval, &entry->expire);
+    timer_catch_up(ml, entry, now);
+    pending_add(ml, index);
+  }
+  ml->current_event = entry->event_id;
+  ml_dispatch(ml, entry, &item->fired);
+  ml->current_event = -1;
+}
+
+/* Leaves a collected event for the next iteration. An io fd is still
+ * ready then, an expired timer is put back into the heap.
+ */
+static void run_postpone(struct ml_data_s *ml, struct ml_run_item *item)
+{
+  int index = entry_lookup(ml, item->event_id);
+
+  ml->stats.postponed++;
+  if ((index >= 0) && (ml->ev_list[index].type != EV_TYPE_IO))
+    pending_add(ml, index);
+}
+
+/* Dispatches the collected events class by class, in the order they were
+ * collected within a class. Posted tasks run right before the telephony
+ * class. Once the budget (if any) is used up, events of the display and
+ * background classes are postponed, but at least one of them runs per
+ * iteration so they cannot starve. Returns the number of events and
+ * tasks which were handled.
+ */
+static int run_dispatch(struct ml_data_s *ml, struct timeval *start)
+{
+  struct timeval limit, now;
+  int prio, i;
+  int count = ml->run_used;
+  int ran_lower = 0;
+
+  timeradd(start, &ml->budget, &limit);
+  for (prio = 0; prio < ML_PRIO_CLASSES; prio++) {
+    if (prio == YP_ML_PRIO_TELEPHONY)
+      count += task_queue_run(ml);
+    for (i = 0; i < ml->run_used; i++) {
+      if (ml->run[i].priority != prio)
         continue;
-      if (ml_data.ev_list[i].type == EV_TYPE_PTIMER) {
-        score = timer_overlap_score(delay, &ml_data.ev_list[i].interval);
-        if (score == 0)
+      if ((prio >= YP_ML_PRIO_DISPLAY) && timerisset(&ml->budget)) {
+        if (ran_lower) {
+          ml_get_time(&now);
+          if (timercmp(&now, &limit, >)) {
+            run_postpone(ml, &ml->run[i]);
+            continue;
+          }
+        }
+        ran_lower = 1;
+      }
+      run_item(ml, &ml->run[i], start);
+    }
+  }
+  ml->run_used = 0;
+  return count;
+}
+
+/*****************************************************************/
+
+int yp_mlc_run(yp_ml_t *ml)
+{
+  struct event_list *current;
+  struct ready_event ready[MAX_READY_EVENTS];
+  struct timeval tv, now, real_now, deadline, run_start;
+  int ret, index, i;
+  int timeout, busy;
+  int result;
+
+  if (ml->is_running) {
+    fprintf(stderr, "mainloop is already running\n");
+    return 0;
+  }
+  if (ml->backend == NULL) {
+    fprintf(stderr, "mainloop not initialized\n");
+    return -EFAULT;
+  }
+  ml->is_running = 1;
+  result = 0;
+  ml->thread  = pthread_self();
+  ml_get_time(&run_start);
+  
+  while (ml->is_running) {
+    /* the timer to expire next is on top of the heap */
+    if (ml->heap_used == 0) {
+      /* no timer -> wait for 1 hour */
+      timeout = 3600 * 1000;
+    }
+    else {
+      /* calculate the duration to wait in the backend */
+      current = &ml->ev_list[ml->heap[0]];
+      deadline = current->expire;
+      if (ml->coalescing) {
+        /* wait as long as the slack of all due timers allows */
+        timeradd(&current->expire, &current->slack, &deadline);
+        heap_deadline(ml, 1, &deadline);
+        heap_deadline(ml, 2, &deadline);
+      }
+      ml_get_time(&now);
+      timersub(&deadline, &now, &tv);      /* tv = deadline - now */
+      if ((tv.tv_sec < 0)  || (tv.tv_usec < 0)) {
+        /* timer already expired -> do not wait */
+        timeout = 0;
+      }
+      else {
+        /* round up to avoid waking up too early */
+        timeout = TIMEVAL_TO_MS(&tv) + ((tv.tv_usec % 1000) ? 1 : 0);
+      }
+    }
+    
+    /* deferred callbacks run once the loop is quiet */
+    if (ml->idle_used > 0)
+      timeout = idle_timeout(ml, timeout);
+
+    /* wait for a timer or io event */
+    ret = ml->backend->wait(ml, timeout, ready, MAX_READY_EVENTS);
+    ml->stats.wakeups++;
+
+    if (ml->dump_requested) {
+      ml->dump_requested = 0;
+      ml_dump_to_file(ml);
+    }
+
+    /* events (re)scheduled from now on wait for the next iteration */
+    ml->dispatching = 1;
+
+    if (ret > 0) {
+      /* io event, dispatch the ready fds only */
+      for (i = 0; i < ret; i++) {
+        if (ready[i].index == READY_WAKEUP) {
+          if (ready[i].error) {
+            fprintf(stderr, "mainloop caught exception on internal pipe\n");
+            ml->is_running = 0;
+            result = -EFAULT;
+            break;
+          }
+          else {
+            ml_drain_wakeup(ml);
+          }
+          continue;
+        }
+        if (ready[i].index == READY_SIGNAL) {
+          signal_dispatch(ml);
           continue;
-        if (score == 1) {
-          /* found perfect match */
-          best_index = i;
-          break;
         }
-        if ((best_index < 0) || (score < best_score)) {
-          best_score = score;
-          best_index = i;
+        if (ready[i].index == READY_CLOCK) {
+          clock_changed(ml);
+          continue;
         }
+        /* stale notification of a removed event? */
+        index = entry_lookup(ml, ready[i].event_id);
+        if ((index >= 0) && (ml->ev_list[index].type == EV_TYPE_IO))
+          run_add(ml, index, NULL);
+      }
+      if (result != 0) {
+        ml->dispatching = 0;
+        ml->run_used = 0;
+        break;
+      }
+    }
+    else
+    if ((ret < 0) && (ret != -EINTR)) {
+      /* error */
+      errno = -ret;
+      perror("mainloop caught error");
+      ml->dispatching = 0;
+      ml->is_running = 0;
+      result = ret;
+      break;
+    }
+
+    /* changes from now on need another wakeup, the internal pipe is
+       drained already */
+    __sync_lock_release(&ml->wakeup_signalled);
+    __sync_synchronize();
+
+    busy = (ret != 0);
+
+    ml_get_time(&real_now);
+    
+    /* apply the minimum resolution */
+    MS_TO_TIMEVAL(TIMER_MIN_RESOLUTIN, &tv);
+    timeradd(&real_now, &tv, &now);
+
+    /* collect the expired timers (in correct order!) */
+    while ((ml->heap_used > 0) &&
+           timercmp(&ml->ev_list[ml->heap[0]].expire, &now, <=)) {
+      index = ml->heap[0];
+      if (run_add(ml, index, &ml->ev_list[index].expire) != 0)
+        break;
+      heap_remove(ml, index);
+    }
+
+    /* run the io and timer callbacks as well as tasks posted by other
+       threads, the most urgent ones first */
+    busy |= run_dispatch(ml, &real_now);
+
+    /* deferred callbacks after everything else */
+    if (ml->idle_used > 0)
+      idle_run(ml, !busy);
+
+    ml->dispatching = 0;
+    pending_flush(ml);
+  }
+
+  /* do not lose deferred work when the mainloop is stopped */
+  if ((result == 0) && (ml->idle_used > 0)) {
+    ml->dispatching = 1;
+    idle_run(ml, 1);
+    ml->dispatching = 0;
+    pending_flush(ml);
+  }
+  
+  ml_get_time(&now);
+  timersub(&now, &run_start, &tv);
+  ml->stats.run_time += TIMEVAL_TO_MS(&tv);
+
+  if (result != 0)
+    ml_cleanup(ml);
+  
+  return result;
+}
+
+/*****************************************************************/
+
+int yp_mlc_stop(yp_ml_t *ml)
+{
+  int is_running = ml->is_running;
+
+  ml->is_running = 0;
+  /* always wake up the mainloop, in a signal handler it may be about to
+     wait although a wakeup is marked as outstanding */
+  if (is_running)
+    ml_wakeup(ml);
+  return 0;
+}
+
+/*****************************************************************/
+
+static int ml_cleanup(struct ml_data_s *ml)
+{
+  int i;
+
+  ml->is_running = 0;
+
+  ml_wakeup_close(ml);
+  if (ml->backend) {
+    signal_close(ml);
+    clock_watch_close(ml);
+  }
+  task_queue_free(ml);
+
+  /* Free memory */
+  ml->ev_list_allocated = 0;
+  ml->free_head = -1;
+  if (ml->ev_list) {
+    free(ml->ev_list);
+    ml->ev_list = NULL;
+  }
+  if (ml->groups) {
+    for (i = 0; i < ml->groups_allocated; i++) {
+      if ((ml->groups[i].first != -1) && ml->groups[i].stats)
+        free(ml->groups[i].stats);
+    }
+    free(ml->groups);
+    ml->groups = NULL;
+  }
+  ml->groups_used = ml->groups_allocated = 0;
+  if (ml->heap) {
+    free(ml->heap);
+    ml->heap = NULL;
+  }
+  ml->heap_used = ml->heap_allocated = 0;
+  if (ml->pending) {
+    free(ml->pending);
+    ml->pending = NULL;
+  }
+  ml->pending_used = ml->pending_allocated = 0;
+  if (ml->run) {
+    free(ml->run);
+    ml->run = NULL;
+  }
+  ml->run_used = ml->run_allocated = 0;
+  if (ml->idle) {
+    free(ml->idle);
+    ml->idle = NULL;
+  }
+  ml->idle_used = ml->idle_allocated = 0;
+  ml->idle_checked = 0;
+  if (ml->backend) {
+    ml->backend->shutdown(ml);
+    ml->backend = NULL;
+  }
+
+  return 0;
+}
+
+/*****************************************************************/
+
+/* Returns the number of periods of tm_check until the timers
+ * overlap.
+ * 0 .. there is no (reasonable) overlap detected.
+ * 1 .. a perfect match, every tick overlaps with tm_exist
+ * >1 .. every X ticks overlap.
+ */
+static inline int timer_overlap_score(int tm_check,
+                                      struct timeval *tv_exist)
+{
+  int tm_exist = TIMEVAL_TO_MS(tv_exist);
+  int i;
+  if (!tm_check || !tm_exist) {
+    /* invalid durations */
+    return 0;
+  }
+  if (tm_check == tm_exist) {
+    /* same interval */
+    return 1;
+  }
+  if (tm_exist > tm_check) {
+    for (i = 1; i <= 4; i++)
+      if ((tm_exist * i) % tm_check == 0)
+        return (tm_exist * i) / tm_check;
+  }
+  else {  /* tm_exist < tm_check */
+    for (i = 1; i <= 4; i++)
+      if ((tm_check * i) % tm_exist == 0)
+        return i;
+  }
+  return 0;
+}
+
+/*****************************************************************/
+
+/* Tries to put the expiry of a periodic timer in phase with an existing
+ * periodic timer of a compatible interval. Returns 1 if successful.
+ */
+static int timer_align(struct ml_data_s *ml, int index, int delay,
+                       struct timeval *now)
+{
+  struct event_list *entry = &ml->ev_list[index];
+  int i;
+  int score, best_score, best_index;
+
+  best_index = -1;
+  for (i = 0; i < ml->ev_list_allocated; i++) {
+    if (i == index)
+      continue;
+    if ((ml->ev_list[i].type == EV_TYPE_PTIMER) ||
+        (ml->ev_list[i].type == EV_TYPE_ATIMER)) {
+      score = timer_overlap_score(delay, &ml->ev_list[i].interval);
+      if (score == 0)
+        continue;
+      if (score == 1) {
+        /* found perfect match */
+        best_index = i;
+        break;
+      }
+      if ((best_index < 0) || (score < best_score)) {
+        best_score = score;
+        best_index = i;
       }
     }
   }
   if (best_index >= 0) {
-    struct timeval *tv_ref = &ml_data.ev_list[best_index].expire;
+    struct timeval *tv_ref = &ml->ev_list[best_index].expire;
     struct timeval tv_diff;
     int ms_diff;
     
     entry->expire.tv_sec = tv_ref->tv_sec;
     entry->expire.tv_usec = tv_ref->tv_usec;
     
-    if (timercmp(tv_ref, &now, >)) {
+    if (timercmp(tv_ref, now, >)) {
       /* reference expires in the future (regular case) */
-      timersub(tv_ref, &now, &tv_diff);
+      timersub(tv_ref, now, &tv_diff);
       ms_diff = TIMEVAL_TO_MS(&tv_diff);
       ms_diff = (ms_diff / delay) * delay;
       if (ms_diff > 0) {
@@ -468,142 +1991,491 @@ static int yp_mlint_schedule_timer(int group_id, int delay,
     }
     else {
       /* reference already expired */
-      timersub(&now, tv_ref, &tv_diff);
+      timersub(now, tv_ref, &tv_diff);
       ms_diff = TIMEVAL_TO_MS(&tv_diff);
       ms_diff = ((ms_diff / delay) + 1) * delay;
       /* advance by 'msdiff' milliseconds */
       MS_TO_TIMEVAL(ms_diff, &tv_diff);
       timeradd(&entry->expire, &tv_diff, &entry->expire);   /* expire += diff */
     }
+    return 1;
+  }
+  return 0;
+}
+
+/*****************************************************************/
+
+static int yp_mlint_schedule_timer(struct ml_data_s *ml,
+                                   int group_id, int delay,
+                                   int allow_optimize,
+                                   yp_ml_callback cb, void *private_data,
+                                   enum event_type type)
+{
+  struct event_list *entry;
+  struct timeval now;
+  int index;
+  
+  entry = entry_alloc(ml, type, group_id, &index);
+  if (entry == NULL)
+    return -ENOMEM;
+
+  entry->seq = ml->seq++;
+  MS_TO_TIMEVAL(delay, &entry->interval);
+  entry->callback = cb;
+  entry->callback_data = private_data;
+  entry->catchup = ml->default_catchup;
+  entry->slack = ml->default_slack;
+  
+  ml_get_time(&now);
+
+  if (type == EV_TYPE_ATIMER) {
+    atimer_align(ml, entry, 0);
+    clock_watch_open(ml);
+  }
+  else if (!allow_optimize || !timer_align(ml, index, delay, &now)) {
+    /* no optimization: expire = now + interval */
+    timeradd(&now, &entry->interval, &entry->expire);
+  }
+  if (timer_add(ml, index) != 0) {
+    entry_release(ml, index);
+    return -ENOMEM;
+  }
+  
+  ml_notify(ml);
+
+  return entry->event_id;
+}
+
+/*****************************************************************/
+
+int yp_mlc_schedule_timer(yp_ml_t *ml, int group_id, int delay,
+                          yp_ml_callback cb, void *private_data)
+{
+  return yp_mlint_schedule_timer(ml, group_id, delay, 0, cb, private_data,
+                                 EV_TYPE_TIMER);
+}
+
+/*****************************************************************/
+
+int yp_mlc_schedule_periodic_timer(yp_ml_t *ml, int group_id, int interval,
+                                   int allow_optimize,
+                                   yp_ml_callback cb, void *private_data)
+{
+  return yp_mlint_schedule_timer(ml, group_id, interval, allow_optimize,
+                                 cb, private_data,
+                                 EV_TYPE_PTIMER);
+}
+
+/*****************************************************************/
+
+int yp_mlc_schedule_aligned_timer(yp_ml_t *ml, int group_id, int interval,
+                                  yp_ml_callback cb, void *private_data)
+{
+  if (interval <= 0)
+    return -EINVAL;
+  return yp_mlint_schedule_timer(ml, group_id, interval, 0,
+                                 cb, private_data,
+                                 EV_TYPE_ATIMER);
+}
+
+/*****************************************************************/
+
+int yp_mlc_set_catchup_policy(yp_ml_t *ml, int event_id,
+                              yp_ml_catchup_policy policy)
+{
+  int index;
+
+  if (event_id < 0) {
+    /* default for timers scheduled from now on */
+    ml->default_catchup = policy;
+    return 0;
+  }
+  index = entry_lookup(ml, event_id);
+  if ((index < 0) || (ml->ev_list[index].type != EV_TYPE_PTIMER))
+    return -ENOENT;
+  ml->ev_list[index].catchup = policy;
+  return 0;
+}
+
+/*****************************************************************/
+
+int yp_mlc_set_timer_slack(yp_ml_t *ml, int event_id, int slack)
+{
+  int index;
+
+  if (slack < 0)
+    return -EINVAL;
+  if (event_id < 0) {
+    /* default for timers scheduled from now on */
+    MS_TO_TIMEVAL(slack, &ml->default_slack);
+    return 0;
   }
-  else {
-    /* no optimization: expire = now + interval */
-    timeradd(&now, &entry->interval, &entry->expire);
+  index = entry_lookup(ml, event_id);
+  if ((index < 0) || ((ml->ev_list[index].type != EV_TYPE_TIMER) &&
+                      (ml->ev_list[index].type != EV_TYPE_PTIMER) &&
+                      (ml->ev_list[index].type != EV_TYPE_ATIMER)))
+    return -ENOENT;
+  MS_TO_TIMEVAL(slack, &ml->ev_list[index].slack);
+  return 0;
+}
+
+/*****************************************************************/
+
+int yp_mlc_set_priority(yp_ml_t *ml, int event_id, yp_ml_priority priority)
+{
+  int index;
+
+  if ((priority < 0) || (priority >= ML_PRIO_CLASSES))
+    return -EINVAL;
+  if (event_id < 0) {
+    /* default for events added from now on */
+    ml->default_priority = priority;
+    return 0;
   }
-  
-  res = write(ml_data.wakeup_write, &best_index, 1);
+  index = entry_lookup(ml, event_id);
+  if (index < 0)
+    return -ENOENT;
+  ml->ev_list[index].priority = priority;
+  return 0;
+}
 
-  return entry->event_id;
+/*****************************************************************/
+
+int yp_mlc_set_dispatch_budget(yp_ml_t *ml, int budget)
+{
+  if (budget < 0)
+    return -EINVAL;
+  MS_TO_TIMEVAL(budget, &ml->budget);
+  return 0;
 }
 
 /*****************************************************************/
 
-int yp_ml_schedule_timer(int group_id, int delay,
-                         yp_ml_callback cb, void *private_data)
+void yp_mlc_set_coalescing(yp_ml_t *ml, int enable)
 {
-  return yp_mlint_schedule_timer(group_id, delay, 0, cb, private_data,
-                                 EV_TYPE_TIMER);
+  ml->coalescing = enable;
 }
 
 /*****************************************************************/
 
-int yp_ml_schedule_periodic_timer(int group_id, int interval,
-                                  int allow_optimize,
-                                  yp_ml_callback cb, void *private_data)
+void yp_mlc_set_profiling(yp_ml_t *ml, int enable)
 {
-  return yp_mlint_schedule_timer(group_id, interval, allow_optimize,
-                                 cb, private_data,
-                                 EV_TYPE_PTIMER);
+  ml->profiling = enable;
+}
+
+void yp_mlc_set_stats_file(yp_ml_t *ml, const char *path)
+{
+  ml->stats_file = path;
+}
+
+/* May be called from a signal handler. */
+void yp_mlc_request_stats_dump(yp_ml_t *ml)
+{
+  ml->dump_requested = 1;
+  ml_signal(ml);
 }
 
 /*****************************************************************/
 
-int yp_ml_reschedule_periodic_timer(int event_id, int interval,
-                                    int allow_optimize)
+static void hist_dump(FILE *f, const char *name, struct ml_hist *hist)
+{
+  int i;
+
+  if (hist->count == 0)
+    return;
+  fprintf(f, "  %s_us:", name);
+  for (i = 0; i < ML_HIST_BUCKETS; i++) {
+    if (hist->bucket[i] == 0)
+      continue;
+    if (i < ML_HIST_BUCKETS - 1)
+      fprintf(f, " <%lu:%lu", 2UL << i, hist->bucket[i]);
+    else
+      fprintf(f, " >=%lu:%lu", 1UL << i, hist->bucket[i]);
+  }
+  fprintf(f, "\n");
+}
+
+static int group_cmp(const void *a, const void *b)
+{
+  return (*(struct group_entry **) a)->group_id -
+         (*(struct group_entry **) b)->group_id;
+}
+
+void yp_mlc_dump_stats(yp_ml_t *ml, FILE *f)
 {
-  fprintf(stderr, "%s not yet implemented!\n", __FUNCTION__);
-  abort();
+  struct group_entry **sorted;
+  struct ml_group_stats *gs;
+  int i, num = 0;
+
+  fprintf(f, "mainloop: wakeups=%llu wakeups_avoided=%lu missed_ticks=%llu "
+             "postponed=%llu run_time_ms=%llu\n",
+          ml->stats.wakeups, ml->stats.wakeups_avoided,
+          ml->stats.missed_ticks, ml->stats.postponed, ml->stats.run_time);
+  if (!ml->profiling) {
+    fprintf(f, "mainloop: profiling disabled\n");
+    fflush(f);
+    return;
+  }
+
+  sorted = malloc(ml->groups_allocated * sizeof(sorted[0]));
+  if (sorted == NULL)
+    return;
+  for (i = 0; i < ml->groups_allocated; i++) {
+    if ((ml->groups[i].first != -1) && ml->groups[i].stats)
+      sorted[num++] = &ml->groups[i];
+  }
+  qsort(sorted, num, sizeof(sorted[0]), group_cmp);
+
+  for (i = 0; i < num; i++) {
+    gs = sorted[i]->stats;
+    fprintf(f, "group %d: calls=%lu run_avg_us=%llu run_max_us=%lu",
+            sorted[i]->group_id, gs->run.count,
+            (gs->run.count) ? gs->run.total / gs->run.count : 0,
+            gs->run.max);
+    if (gs->late.count) {
+      fprintf(f, " late_avg_us=%llu late_max_us=%lu",
+              gs->late.total / gs->late.count, gs->late.max);
+    }
+    fprintf(f, "\n");
+    hist_dump(f, "run", &gs->run);
+    hist_dump(f, "late", &gs->late);
+  }
+  fflush(f);
+  free(sorted);
 }
 
 /*****************************************************************/
 
-int yp_ml_poll_io(int group_id, int fd,
-                  yp_ml_callback cb, void *private_data)
+void yp_mlc_get_stats(yp_ml_t *ml, struct yp_ml_stats *stats)
+{
+  memcpy(stats, &ml->stats, sizeof(*stats));
+}
+
+/*****************************************************************/
+
+/* Changes the interval of a periodic timer, keeping its id. When called
+ * from the timer's own callback the next expiry is measured from the tick
+ * which has just fired (so there is no drift), otherwise from now.
+ */
+int yp_mlc_reschedule_periodic_timer(yp_ml_t *ml, int event_id, int interval,
+                                     int allow_optimize)
 {
   struct event_list *entry;
-  ssize_t res;
+  struct timeval now, base;
+  int index;
+
+  index = entry_lookup(ml, event_id);
+  if ((index < 0) || ((ml->ev_list[index].type != EV_TYPE_PTIMER) &&
+                      (ml->ev_list[index].type != EV_TYPE_ATIMER)))
+    return -ENOENT;
+  if (interval <= 0)
+    return -EINVAL;
+  entry = &ml->ev_list[index];
+
+  ml_get_time(&now);
+  if (event_id == ml->current_event)
+    timersub(&entry->expire, &entry->interval, &base);
+  else
+    base = now;
+
+  MS_TO_TIMEVAL(interval, &entry->interval);
+  if (entry->type == EV_TYPE_ATIMER)
+    atimer_align(ml, entry, (event_id == ml->current_event));
+  else
+  if (!allow_optimize || !timer_align(ml, index, interval, &now))
+    timeradd(&base, &entry->interval, &entry->expire);
+  entry->seq = ml->seq++;
+
+  /* a pending timer gets into the heap after the dispatch anyway */
+  if (entry->heap_pos >= 0) {
+    heap_remove(ml, index);
+    heap_insert(ml, index);
+  }
+
+  /* the loop recalculates its timeout before waiting again */
+  ml_notify(ml);
+
+  return event_id;
+}
+
+/*****************************************************************/
+
+int yp_mlc_poll_io(yp_ml_t *ml, int group_id, int fd,
+                   yp_ml_callback cb, void *private_data)
+{
+  struct event_list *entry;
+  int index, ret;
   
-  entry = get_free_entry(NULL);
+  entry = entry_alloc(ml, EV_TYPE_IO, group_id, &index);
   if (entry == NULL)
     return -ENOMEM;
 
-  entry->type = EV_TYPE_IO;
-  entry->event_id = ++ml_data.event_id_max;
-  entry->group_id = group_id;
   entry->fd = fd;
   entry->callback = cb;
   entry->callback_data = private_data;
 
-  FD_SET(fd, &ml_data.select_master_set);
-  if (ml_data.select_max_fd <= fd)
-    ml_data.select_max_fd = fd + 1;
+  ret = ml->backend->add_fd(ml, fd, index, entry->event_id);
+  if (ret < 0) {
+    entry_release(ml, index);
+    return ret;
+  }
   
-  res = write(ml_data.wakeup_write, &fd, 1);
+  ml_notify(ml);
   
   return entry->event_id;
 }
 
 /*****************************************************************/
 
-int yp_ml_remove_event(int event_id, int group_id)
+int yp_mlc_defer(yp_ml_t *ml, int group_id, int deadline,
+                 yp_ml_callback cb, void *private_data)
+{
+  struct event_list *entry;
+  struct timeval now, tv;
+  int index;
+
+  if (ml->idle_used >= ml->idle_allocated) {
+    int new_size = (ml->idle_allocated) ?
+                   2 * ml->idle_allocated : INITIAL_EV_LIST_SIZE;
+    int *new_idle = realloc(ml->idle, new_size * sizeof(new_idle[0]));
+    if (new_idle == NULL)
+      return -ENOMEM;
+    ml->idle = new_idle;
+    ml->idle_allocated = new_size;
+  }
+
+  entry = entry_alloc(ml, EV_TYPE_IDLE, group_id, &index);
+  if (entry == NULL)
+    return -ENOMEM;
+  entry->callback = cb;
+  entry->callback_data = private_data;
+  timerclear(&entry->interval);
+  if (deadline >= 0) {
+    ml_get_time(&now);
+    MS_TO_TIMEVAL(deadline, &tv);
+    timeradd(&now, &tv, &entry->expire);
+  }
+  else {
+    timerclear(&entry->expire);
+  }
+  ml->idle[ml->idle_used++] = entry->event_id;
+  ml->idle_checked = 0;
+
+  /* the loop must not stay blocked */
+  ml_notify(ml);
+
+  return entry->event_id;
+}
+
+/*****************************************************************/
+
+int yp_mlc_watch_signal(yp_ml_t *ml, int group_id, int signum,
+                        yp_ml_callback cb, void *private_data)
+{
+  struct event_list *entry;
+  int index, ret;
+
+  if ((signum <= 0) || (signum >= NSIG))
+    return -EINVAL;
+  if ((ml->sig_read < 0) && ((ret = signal_open(ml)) != 0))
+    return ret;
+
+  entry = entry_alloc(ml, EV_TYPE_SIGNAL, group_id, &index);
+  if (entry == NULL)
+    return -ENOMEM;
+  entry->fd = signum;
+  entry->callback = cb;
+  entry->callback_data = private_data;
+  if (sigismember(&ml->sig_mask, signum) != 1)
+    signal_watch(ml, signum);
+
+  return entry->event_id;
+}
+
+/*****************************************************************/
+
+/* Removes a single event, returns 1 if it was an io event. */
+static int remove_entry(struct ml_data_s *ml, int index)
+{
+  struct event_list *entry = &ml->ev_list[index];
+  int is_io = (entry->type == EV_TYPE_IO);
+  int signum = (entry->type == EV_TYPE_SIGNAL) ? entry->fd : 0;
+
+  if (is_io)
+    ml->backend->del_fd(ml, entry->fd);
+  entry_release(ml, index);
+  if (signum)
+    signal_unwatch(ml, signum);
+  return is_io;
+}
+
+int yp_mlc_remove_event(yp_ml_t *ml, int event_id, int group_id)
 {
+  struct group_entry *group;
   int count = 0;
   int need_wakeup = 0;
-  int max_fd = 0;
-  int i;
-  ssize_t res;
-  struct event_list *current;
+  int index, next;
   
-  current = &ml_data.ev_list[ml_data.ev_list_used - 1];
-  for (i = ml_data.ev_list_used; i > 0 ; i--, current--) {
-    if ((current->type != EV_TYPE_EMPTY) &&
-        ((event_id < 0) || (current->event_id == i)) &&
-        ((group_id < 0) || (current->group_id == group_id))) {
-      if (current->type == EV_TYPE_IO) {
-        FD_CLR(current->fd, &ml_data.select_master_set);
-        need_wakeup = 1;
-      }
-      if (i == ml_data.ev_list_used) {
-        /* last entry -> shrink the list */
-        ml_data.ev_list_used--;
-      }
-      else {
-        /* other entry -> mark empty */
-        current->type = EV_TYPE_EMPTY;
-      }
+  if (event_id >= 0) {
+    /* a single event */
+    index = entry_lookup(ml, event_id);
+    if ((index >= 0) &&
+        ((group_id < 0) || (ml->ev_list[index].group_id == group_id))) {
+      need_wakeup = remove_entry(ml, index);
+      count = 1;
+    }
+  }
+  else
+  if (group_id >= 0) {
+    /* all events of a group */
+    group = group_lookup(ml, group_id, 0);
+    index = (group) ? group->first : -1;
+    while (index >= 0) {
+      next = ml->ev_list[index].group_next;
+      need_wakeup |= remove_entry(ml, index);
       count++;
+      index = next;
     }
-    else
-    if (current->type == EV_TYPE_IO) {
-      /* recalculate max_fd */
-      if (max_fd < current->fd)
-        max_fd = current->fd;
+  }
+  else {
+    /* all events */
+    for (index = 0; index < ml->ev_list_allocated; index++) {
+      if (ml->ev_list[index].type != EV_TYPE_EMPTY) {
+        need_wakeup |= remove_entry(ml, index);
+        count++;
+      }
     }
   }
   
-  if (need_wakeup) {
-    ml_data.select_max_fd = max_fd + 1;
-    res = write(ml_data.wakeup_write, &max_fd, 1);
-  }
+  if (need_wakeup)
+    ml_notify(ml);
   
   return count;
 }
 
 /*****************************************************************/
 
-int yp_ml_count_events(int event_id, int group_id)
+int yp_mlc_count_events(yp_ml_t *ml, int event_id, int group_id)
 {
+  struct group_entry *group;
   int count = 0;
-  int i;
-  struct event_list *current;
+  int index;
   
-  current = ml_data.ev_list;
-  for (i = 0; i < ml_data.ev_list_used; i++, current++) {
-    if ((current->type != EV_TYPE_EMPTY) &&
-        ((event_id < 0) || (current->event_id == i)) &&
-        ((group_id < 0) || (current->group_id == group_id))) {
-      count++;
-    }
+  if (event_id >= 0) {
+    index = entry_lookup(ml, event_id);
+    if ((index >= 0) &&
+        ((group_id < 0) || (ml->ev_list[index].group_id == group_id)))
+      count = 1;
+  }
+  else
+  if (group_id >= 0) {
+    group = group_lookup(ml, group_id, 0);
+    count = (group) ? group->count : 0;
+  }
+  else {
+    for (index = 0; index < ml->ev_list_allocated; index++)
+      if (ml->ev_list[index].type != EV_TYPE_EMPTY)
+        count++;
   }
   
   return count;
@@ -611,12 +2483,204 @@ int yp_ml_count_events(int event_id, int group_id)
 
 /*****************************************************************/
 
-int yp_ml_same_thread(void) {
+int yp_mlc_same_thread(yp_ml_t *ml) {
 #ifdef HAVE_PTHREAD_H
-  return (ml_data.is_running) ? pthread_equal(pthread_self(), ml_data.thread) : 1;
+  return (ml->is_running) ? pthread_equal(pthread_self(), ml->thread) : 1;
 #else
   return 1;
 #endif
 }
 
+/*****************************************************************/
+
+int yp_mlc_post(yp_ml_t *ml, yp_ml_task_callback cb, void *private_data)
+{
+  struct ml_task *task;
+
+  if (cb == NULL)
+    return -EINVAL;
+  task = malloc(sizeof(*task));
+  if (task == NULL)
+    return -ENOMEM;
+  task->callback = cb;
+  task->callback_data = private_data;
+  task_push(ml, task);
+
+  /* only the first task of a batch wakes up the mainloop */
+  ml_signal(ml);
+  return 0;
+}
+
+/*****************************************************************/
+
+yp_ml_t *yp_mlc_create()
+{
+  struct ml_data_s *ml;
+
+  ml = malloc(sizeof(*ml));
+  if (ml == NULL)
+    return NULL;
+  if (ml_init(ml) != 0) {
+    free(ml);
+    return NULL;
+  }
+  return ml;
+}
+
+void yp_mlc_destroy(yp_ml_t *ml)
+{
+  if (ml == NULL)
+    return;
+  ml_cleanup(ml);
+  free(ml);
+}
+
+yp_ml_t *yp_ml_default()
+{
+  return &ml_default;
+}
+
+/*****************************************************************/
+/* the functions working on the default instance                 */
+
+int yp_ml_init()
+{
+  return ml_init(&ml_default);
+}
+
+int yp_ml_run()
+{
+  return yp_mlc_run(&ml_default);
+}
+
+int yp_ml_stop()
+{
+  return yp_mlc_stop(&ml_default);
+}
+
+int yp_ml_shutdown()
+{
+  return ml_cleanup(&ml_default);
+}
+
+int yp_ml_schedule_timer(int group_id, int delay,
+                         yp_ml_callback cb, void *private_data)
+{
+  return yp_mlc_schedule_timer(&ml_default, group_id, delay,
+                               cb, private_data);
+}
+
+int yp_ml_schedule_periodic_timer(int group_id, int interval,
+                                  int allow_optimize,
+                                  yp_ml_callback cb, void *private_data)
+{
+  return yp_mlc_schedule_periodic_timer(&ml_default, group_id, interval,
+                                        allow_optimize, cb, private_data);
+}
+
+int yp_ml_schedule_aligned_timer(int group_id, int interval,
+                                 yp_ml_callback cb, void *private_data)
+{
+  return yp_mlc_schedule_aligned_timer(&ml_default, group_id, interval,
+                                       cb, private_data);
+}
+
+int yp_ml_set_catchup_policy(int event_id, yp_ml_catchup_policy policy)
+{
+  return yp_mlc_set_catchup_policy(&ml_default, event_id, policy);
+}
+
+int yp_ml_set_timer_slack(int event_id, int slack)
+{
+  return yp_mlc_set_timer_slack(&ml_default, event_id, slack);
+}
+
+int yp_ml_set_priority(int event_id, yp_ml_priority priority)
+{
+  return yp_mlc_set_priority(&ml_default, event_id, priority);
+}
+
+int yp_ml_set_dispatch_budget(int budget)
+{
+  return yp_mlc_set_dispatch_budget(&ml_default, budget);
+}
+
+void yp_ml_set_coalescing(int enable)
+{
+  yp_mlc_set_coalescing(&ml_default, enable);
+}
+
+int yp_ml_reschedule_periodic_timer(int event_id, int interval,
+                                    int allow_optimize)
+{
+  return yp_mlc_reschedule_periodic_timer(&ml_default, event_id, interval,
+                                          allow_optimize);
+}
+
+int yp_ml_poll_io(int group_id, int fd,
+                  yp_ml_callback cb, void *private_data)
+{
+  return yp_mlc_poll_io(&ml_default, group_id, fd, cb, private_data);
+}
+
+int yp_ml_defer(int group_id, int deadline,
+                yp_ml_callback cb, void *private_data)
+{
+  return yp_mlc_defer(&ml_default, group_id, deadline, cb, private_data);
+}
+
+int yp_ml_watch_signal(int group_id, int signum,
+                       yp_ml_callback cb, void *private_data)
+{
+  return yp_mlc_watch_signal(&ml_default, group_id, signum, cb, private_data);
+}
+
+int yp_ml_remove_event(int event_id, int group_id)
+{
+  return yp_mlc_remove_event(&ml_default, event_id, group_id);
+}
+
+int yp_ml_count_events(int event_id, int group_id)
+{
+  return yp_mlc_count_events(&ml_default, event_id, group_id);
+}
+
+int yp_ml_same_thread(void)
+{
+  return yp_mlc_same_thread(&ml_default);
+}
+
+int yp_ml_post(yp_ml_task_callback cb, void *private_data)
+{
+  return yp_mlc_post(&ml_default, cb, private_data);
+}
+
+void yp_ml_get_time(struct timeval *tv)
+{
+  ml_get_time(tv);
+}
+
+void yp_ml_get_stats(struct yp_ml_stats *stats)
+{
+  yp_mlc_get_stats(&ml_default, stats);
+}
+
+void yp_ml_set_profiling(int enable)
+{
+  yp_mlc_set_profiling(&ml_default, enable);
+}
 
+void yp_ml_dump_stats(FILE *f)
+{
+  yp_mlc_dump_stats(&ml_default, f);
+}
+
+void yp_ml_set_stats_file(const char *path)
+{
+  yp_mlc_set_stats_file(&ml_default, path);
+}
+
+void yp_ml_request_stats_dump(void)
+{
+  yp_mlc_request_stats_dump(&ml_default);
+}
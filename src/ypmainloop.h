@@ -27,7 +27,49 @@
 #ifndef YPMAINLOOP_H
 #define YPMAINLOOP_H
 
+#include <stdio.h>
+#include <sys/time.h>
+
+/* Timers may run up to this many [ms] before they expire, so that timers
+ * close to each other are handled in one go. */
+#define YP_ML_RESOLUTION  10
+
 typedef void (*yp_ml_callback)(int id, int group, void *private_data);
+typedef void (*yp_ml_task_callback)(void *private_data);
+
+/* What a periodic timer does if it could not run for one or more
+ * intervals, eg. after a suspend or a long blocking callback. */
+typedef enum {
+  YP_ML_CATCHUP_COALESCE = 0,   /* run once, stay in phase (default) */
+  YP_ML_CATCHUP_SKIP,           /* run once, restart the period from now */
+  YP_ML_CATCHUP_REPLAY          /* run once for every missed tick */
+} yp_ml_catchup_policy;
+
+/* Events ready in the same loop iteration are dispatched by class, in
+ * the order given here. Events of the same class keep their order. */
+typedef enum {
+  YP_ML_PRIO_INPUT = 0,         /* handset keys */
+  YP_ML_PRIO_TELEPHONY,         /* liblinphone, call handling (default) */
+  YP_ML_PRIO_DISPLAY,           /* display and LED updates */
+  YP_ML_PRIO_BACKGROUND         /* anything else which may wait */
+} yp_ml_priority;
+
+struct yp_ml_stats {
+  unsigned long long missed_ticks;   /* overdue periodic timer ticks */
+  unsigned long wakeups_avoided;     /* internal wakeups not needed */
+  unsigned long long wakeups;        /* returns from the io backend */
+  unsigned long long run_time;       /* time spent in yp_ml_run in [ms] */
+  unsigned long long postponed;      /* events left over due to the budget */
+};
+
+/* A mainloop instance. The yp_ml_* functions work on a default instance
+ * set up by yp_ml_init, the yp_mlc_* functions on an explicit one, eg. to
+ * run a separate loop per handset in its own thread. An instance must
+ * only be used from the thread running it, except for yp_mlc_post,
+ * yp_mlc_stop and yp_mlc_request_stats_dump. */
+typedef struct ml_data_s yp_ml_t;
+
+int yp_ml_select_backend(const char *name);
 
 int yp_ml_init();
 int yp_ml_run();
@@ -41,16 +83,118 @@ int yp_ml_schedule_periodic_timer(int group_id, int interval,
                                   int allow_optimize,
                                   yp_ml_callback cb, void *private_data);
 
+/* Runs 'cb' just after the wall clock passes a multiple of 'interval'
+ * [ms] since the epoch, eg. every full second or minute. The timer keeps
+ * in step with the system time, also when it is set. */
+int yp_ml_schedule_aligned_timer(int group_id, int interval,
+                                 yp_ml_callback cb, void *private_data);
+
+int yp_ml_set_catchup_policy(int event_id, yp_ml_catchup_policy policy);
+
+/* Timer coalescing: a timer may run up to 'slack' ms late so that timers
+ * due within their slack windows share a single wakeup. The slack is
+ * ignored unless coalescing is enabled. An event_id < 0 sets the default
+ * for timers scheduled from now on. */
+int yp_ml_set_timer_slack(int event_id, int slack);
+void yp_ml_set_coalescing(int enable);
+
+/* Sets the priority class of an io or timer event, an event_id < 0 sets
+ * the default for events added from now on. Deferred callbacks always
+ * run last, signal callbacks first. */
+int yp_ml_set_priority(int event_id, yp_ml_priority priority);
+
+/* Limits the time [ms] an iteration spends on display and background
+ * events, the rest is postponed to the next iteration so that input is
+ * checked again in between. 0 (the default) means no limit. */
+int yp_ml_set_dispatch_budget(int budget);
+
 int yp_ml_reschedule_periodic_timer(int event_id, int interval,
                                     int allow_optimize);
 
+/* Calls 'cb' whenever 'fd' is readable. Each fd can be watched by a
+ * single event only, another one fails with -EEXIST. */
 int yp_ml_poll_io(int group_id, int fd,
                   yp_ml_callback cb, void *private_data);
 
+/* Runs 'cb' once after all ready io events and due timers have been
+ * handled, ie. when the loop has nothing else to do. A deadline >= 0 [ms]
+ * makes it run at the end of a loop iteration once the deadline has
+ * passed, even if the loop is still busy, so 0 means at the end of the
+ * current iteration. While it waits for the loop to get quiet, the loop
+ * sleeps until the deadline between its checks. Pending deferred
+ * callbacks run when the loop stops. */
+int yp_ml_defer(int group_id, int deadline,
+                yp_ml_callback cb, void *private_data);
+
+/* Runs 'cb' in the mainloop whenever the signal 'signum' was received,
+ * instead of in signal context. A signalfd is used if available, so the
+ * signal is blocked in the calling thread; call this before creating
+ * other threads. A signal should be watched by a single instance only. */
+int yp_ml_watch_signal(int group_id, int signum,
+                       yp_ml_callback cb, void *private_data);
+
 int yp_ml_remove_event(int event_id, int group_id);
 
 int yp_ml_count_events(int event_id, int group_id);
 
 int yp_ml_same_thread(void);
 
+/* Runs 'cb' on the mainloop thread as soon as possible. May be called
+ * from any thread once the mainloop is initialized, tasks posted by one
+ * thread run in the order they were posted. */
+int yp_ml_post(yp_ml_task_callback cb, void *private_data);
+
+/* The monotonic time the timers are based on. */
+void yp_ml_get_time(struct timeval *tv);
+
+void yp_ml_get_stats(struct yp_ml_stats *stats);
+
+/* Profiling records the number of callbacks per group, a histogram of
+ * their run time and how late timers fired. It is off by default. */
+void yp_ml_set_profiling(int enable);
+void yp_ml_dump_stats(FILE *f);
+
+/* The dump is written by the mainloop thread, to 'path' if set or to
+ * stderr. yp_ml_request_stats_dump may be called from a signal handler. */
+void yp_ml_set_stats_file(const char *path);
+void yp_ml_request_stats_dump(void);
+
+/* explicit instances */
+yp_ml_t *yp_mlc_create();
+void yp_mlc_destroy(yp_ml_t *ml);
+yp_ml_t *yp_ml_default();
+
+int yp_mlc_run(yp_ml_t *ml);
+int yp_mlc_stop(yp_ml_t *ml);
+int yp_mlc_schedule_timer(yp_ml_t *ml, int group_id, int delay,
+                          yp_ml_callback cb, void *private_data);
+int yp_mlc_schedule_periodic_timer(yp_ml_t *ml, int group_id, int interval,
+                                   int allow_optimize,
+                                   yp_ml_callback cb, void *private_data);
+int yp_mlc_schedule_aligned_timer(yp_ml_t *ml, int group_id, int interval,
+                                  yp_ml_callback cb, void *private_data);
+int yp_mlc_set_catchup_policy(yp_ml_t *ml, int event_id,
+                              yp_ml_catchup_policy policy);
+int yp_mlc_set_timer_slack(yp_ml_t *ml, int event_id, int slack);
+void yp_mlc_set_coalescing(yp_ml_t *ml, int enable);
+int yp_mlc_set_priority(yp_ml_t *ml, int event_id, yp_ml_priority priority);
+int yp_mlc_set_dispatch_budget(yp_ml_t *ml, int budget);
+int yp_mlc_reschedule_periodic_timer(yp_ml_t *ml, int event_id, int interval,
+                                     int allow_optimize);
+int yp_mlc_poll_io(yp_ml_t *ml, int group_id, int fd,
+                   yp_ml_callback cb, void *private_data);
+int yp_mlc_defer(yp_ml_t *ml, int group_id, int deadline,
+                 yp_ml_callback cb, void *private_data);
+int yp_mlc_watch_signal(yp_ml_t *ml, int group_id, int signum,
+                        yp_ml_callback cb, void *private_data);
+int yp_mlc_remove_event(yp_ml_t *ml, int event_id, int group_id);
+int yp_mlc_count_events(yp_ml_t *ml, int event_id, int group_id);
+int yp_mlc_same_thread(yp_ml_t *ml);
+int yp_mlc_post(yp_ml_t *ml, yp_ml_task_callback cb, void *private_data);
+void yp_mlc_get_stats(yp_ml_t *ml, struct yp_ml_stats *stats);
+void yp_mlc_set_profiling(yp_ml_t *ml, int enable);
+void yp_mlc_dump_stats(yp_ml_t *ml, FILE *f);
+void yp_mlc_set_stats_file(yp_ml_t *ml, const char *path);
+void yp_mlc_request_stats_dump(yp_ml_t *ml);
+
 #endif
@@ -0,0 +1,1279 @@
+/****************************************************************************
+ *
+ *  File: ypmlbench.c
+ *
+ *  Copyright (C) 2008  Thomas Reitmayr <treitmayr@devbase.at>
+ *
+ ****************************************************************************
+ *
+ *  This file is part of Yeaphone.
+ *
+ *  Yeaphone is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/* Benchmarks for the mainloop and the handset access, run with
+ * "make bench".
+ * Every result is printed as a single line of "key=value" pairs, so the
+ * output of two runs can be compared with standard text tools. Without
+ * arguments all benchmarks are run, otherwise only the named ones.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <linux/input.h>
+#include "ypmainloop.h"
+#include "ylsysfs.h"
+#include "yldisp.h"
+#include "ylsim.h"
+#include "config.h"
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+#ifdef HAVE_SYS_PTRACE_H
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#endif
+
+#define BENCH_ONESHOT_ID   1
+#define BENCH_PERIODIC_ID  2
+#define BENCH_STOP_ID      3
+#define BENCH_IO_ID        5
+#define BENCH_IDLE_TIMER_ID 6
+#define BENCH_JITTER_ID    7
+#define BENCH_SCHEDULE_ID  8
+#define BENCH_KEY_ID       9
+#define BENCH_DISPLAY_ID   10
+#define BENCH_SIM_IO_ID    11
+#define BENCH_SIM_KEY_ID   12
+#define BENCH_REDRAW_ID    13
+#define BENCH_SETTLED_ID   14
+#define BENCH_SCENE_ID     15
+
+/*****************************************************************/
+
+static long long cpu_usec()
+{
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF, &ru);
+  return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL +
+         ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static long long wall_usec()
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+/* monotonic time for latency measurements */
+static long long mono_usec()
+{
+#ifdef HAVE_CLOCK_GETTIME
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+#endif
+  return wall_usec();
+}
+
+static void stop_callback(int id, int group, void *private_data)
+{
+  yp_ml_stop();
+}
+
+static void null_callback(int id, int group, void *private_data)
+{
+}
+
+static int cmp_llong(const void *a, const void *b)
+{
+  long long d = *(const long long *) a - *(const long long *) b;
+
+  return (d < 0) ? -1 : (d > 0);
+}
+
+/* Prints "<prefix>_avg=... <prefix>_p50=... <prefix>_p99=... <prefix>_max=..."
+ * of 'n' samples (which get sorted).
+ */
+static void print_dist(const char *prefix, long long *sample, int n)
+{
+  long long sum = 0;
+  int i;
+
+  if (n == 0) {
+    printf(" %s_samples=0", prefix);
+    return;
+  }
+  qsort(sample, n, sizeof(sample[0]), cmp_llong);
+  for (i = 0; i < n; i++)
+    sum += sample[i];
+  printf(" %s_avg=%lld %s_p50=%lld %s_p99=%lld %s_max=%lld",
+         prefix, sum / n, prefix, sample[n / 2],
+         prefix, sample[(n * 99) / 100], prefix, sample[n - 1]);
+}
+
+/*****************************************************************/
+/* schedule/remove throughput                                    */
+
+static void bench_schedule(int n)
+{
+  long long start, t_schedule, t_remove, t_group;
+  int *ids;
+  int i;
+
+  ids = malloc(n * sizeof(ids[0]));
+  srand(1);
+  yp_ml_init();
+
+  /* single ids, timers far in the future in random order */
+  start = mono_usec();
+  for (i = 0; i < n; i++) {
+    ids[i] = yp_ml_schedule_timer(BENCH_SCHEDULE_ID, 3600000 + rand() % 1000,
+                                  null_callback, NULL);
+  }
+  t_schedule = mono_usec() - start;
+  start = mono_usec();
+  for (i = 0; i < n; i++)
+    yp_ml_remove_event(ids[i], -1);
+  t_remove = mono_usec() - start;
+
+  /* a whole group at once */
+  for (i = 0; i < n; i++) {
+    yp_ml_schedule_timer(BENCH_SCHEDULE_ID, 3600000 + rand() % 1000,
+                         null_callback, NULL);
+  }
+  start = mono_usec();
+  yp_ml_remove_event(-1, BENCH_SCHEDULE_ID);
+  t_group = mono_usec() - start;
+
+  printf("bench=schedule timers=%d ns_per_schedule=%lld ns_per_remove=%lld "
+         "ns_per_group_remove=%lld\n",
+         n, t_schedule * 1000 / n, t_remove * 1000 / n, t_group * 1000 / n);
+
+  yp_ml_shutdown();
+  free(ids);
+}
+
+/*****************************************************************/
+/* io dispatch with idle timers                                  */
+
+/* A token is passed around a ring of fds (pipes and eventfds), every
+ * callback consumes it from its own fd and hands it to the next one.
+ */
+struct io_source {
+  int read_fd;
+  int write_fd;
+  int next;
+};
+
+struct io_bench {
+  struct io_source *src;
+  int n_fds;
+  int rounds;
+  int dispatched;
+};
+
+static struct io_bench ib;
+
+static void token_write(struct io_source *src)
+{
+  ssize_t res;
+#ifdef HAVE_SYS_EVENTFD_H
+  uint64_t one = 1;
+
+  if (src->read_fd == src->write_fd) {
+    res = write(src->write_fd, &one, sizeof(one));
+    return;
+  }
+#endif
+  res = write(src->write_fd, "", 1);
+}
+
+static void token_callback(int id, int group, void *private_data)
+{
+  struct io_source *src = private_data;
+  char buf[8];
+  ssize_t res;
+
+  res = read(src->read_fd, buf, sizeof(buf));
+  if (++ib.dispatched >= ib.rounds)
+    yp_ml_stop();
+  else
+    token_write(&ib.src[src->next]);
+}
+
+static int io_source_open(struct io_source *src, int use_eventfd)
+{
+  int fd[2];
+
+#ifdef HAVE_SYS_EVENTFD_H
+  if (use_eventfd) {
+    fd[0] = eventfd(0, 0);
+    if (fd[0] >= 0) {
+      fcntl(fd[0], F_SETFL, O_NONBLOCK);
+      src->read_fd = src->write_fd = fd[0];
+      return 0;
+    }
+  }
+#endif
+  if (pipe(fd) != 0) {
+    perror("Cannot create pipe");
+    return -1;
+  }
+  fcntl(fd[0], F_SETFL, O_NONBLOCK);
+  src->read_fd = fd[0];
+  src->write_fd = fd[1];
+  return 0;
+}
+
+static void bench_dispatch(int n_timers, int n_fds, int rounds)
+{
+  long long start, elapsed;
+  int i;
+
+  memset(&ib, 0, sizeof(ib));
+  ib.src = calloc(n_fds, sizeof(ib.src[0]));
+  ib.rounds = rounds;
+  yp_ml_init();
+
+  for (i = 0; i < n_timers; i++) {
+    yp_ml_schedule_timer(BENCH_IDLE_TIMER_ID, 3600000 + i,
+                         null_callback, NULL);
+  }
+  for (i = 0; i < n_fds; i++) {
+    if (io_source_open(&ib.src[i], i & 1) != 0)
+      break;
+    ib.src[i].next = (i + 1) % n_fds;
+    yp_ml_poll_io(BENCH_IO_ID, ib.src[i].read_fd, token_callback, &ib.src[i]);
+  }
+  ib.n_fds = i;
+
+  if (ib.n_fds == n_fds) {
+    token_write(&ib.src[0]);
+    start = mono_usec();
+    yp_ml_run();
+    elapsed = mono_usec() - start;
+
+    printf("bench=dispatch timers=%d fds=%d rounds=%d ns_per_dispatch=%lld\n",
+           n_timers, n_fds, ib.dispatched,
+           elapsed * 1000 / (ib.dispatched + 1));
+  }
+
+  yp_ml_shutdown();
+  for (i = 0; i < ib.n_fds; i++) {
+    if (ib.src[i].write_fd != ib.src[i].read_fd)
+      close(ib.src[i].write_fd);
+    close(ib.src[i].read_fd);
+  }
+  free(ib.src);
+}
+
+/*****************************************************************/
+/* periodic jitter                                               */
+
+struct jitter_bench {
+  long long last;
+  long long *sample;
+  int n;
+  int max_samples;
+};
+
+static struct jitter_bench jb;
+
+static void jitter_callback(int id, int group, void *private_data)
+{
+  long long now = mono_usec();
+
+  if (jb.last)
+    jb.sample[jb.n++] = now - jb.last;
+  jb.last = now;
+  if (jb.n >= jb.max_samples)
+    yp_ml_stop();
+}
+
+/* The intervals measured between the runs of a periodic timer, the
+ * deviation from the nominal interval is the jitter.
+ */
+static void bench_jitter(int interval, int samples)
+{
+  int i;
+
+  memset(&jb, 0, sizeof(jb));
+  jb.sample = calloc(samples, sizeof(jb.sample[0]));
+  jb.max_samples = samples;
+  yp_ml_init();
+  yp_ml_schedule_periodic_timer(BENCH_JITTER_ID, interval, 0,
+                                jitter_callback, NULL);
+  yp_ml_run();
+
+  for (i = 0; i < jb.n; i++) {
+    jb.sample[i] -= interval * 1000LL;
+    if (jb.sample[i] < 0)
+      jb.sample[i] = -jb.sample[i];
+  }
+  printf("bench=jitter interval_ms=%d samples=%d", interval, jb.n);
+  print_dist("jitter_us", jb.sample, jb.n);
+  printf("\n");
+
+  yp_ml_shutdown();
+  free(jb.sample);
+}
+
+/*****************************************************************/
+/* timer dispatch                                                */
+
+struct timer_bench {
+  long long *deadline;       /* expected expiry of each one-shot timer */
+  long long last_deadline;
+  int oneshot_fired;
+  int periodic_fired;
+  int order_errors;
+};
+
+static struct timer_bench tb;
+
+static void oneshot_callback(int id, int group, void *private_data)
+{
+  long long deadline = *(long long *) private_data;
+
+  /* allow for the difference between our clock reading and the loop's */
+  if (deadline + 1000 < tb.last_deadline)
+    tb.order_errors++;
+  if (deadline > tb.last_deadline)
+    tb.last_deadline = deadline;
+  tb.oneshot_fired++;
+}
+
+static void periodic_callback(int id, int group, void *private_data)
+{
+  tb.periodic_fired++;
+}
+
+static void bench_timers(int n_oneshot, int n_periodic, int duration)
+{
+  struct yp_ml_stats stats;
+  long long cpu_start, wall_start;
+  int i, delay;
+
+  memset(&tb, 0, sizeof(tb));
+  tb.deadline = calloc(n_oneshot, sizeof(tb.deadline[0]));
+  srand(1);
+
+  yp_ml_init();
+  wall_start = wall_usec();
+  cpu_start = cpu_usec();
+  for (i = 0; i < n_oneshot; i++) {
+    delay = 1 + rand() % duration;
+    yp_ml_schedule_timer(BENCH_ONESHOT_ID, delay, oneshot_callback,
+                         &tb.deadline[i]);
+    tb.deadline[i] = wall_usec() + delay * 1000LL;
+  }
+  for (i = 0; i < n_periodic; i++) {
+    yp_ml_schedule_periodic_timer(BENCH_PERIODIC_ID, 10 + rand() % 490,
+                                  0, periodic_callback, NULL);
+  }
+  yp_ml_schedule_timer(BENCH_STOP_ID, duration + 10, stop_callback, NULL);
+
+  yp_ml_run();
+  yp_ml_get_stats(&stats);
+
+  printf("bench=timers oneshot=%d periodic=%d duration_ms=%d "
+         "oneshot_fired=%d periodic_fired=%d order_errors=%d "
+         "wakeups_avoided=%lu "
+         "cpu_us=%lld wall_us=%lld ns_per_callback=%lld\n",
+         n_oneshot, n_periodic, duration,
+         tb.oneshot_fired, tb.periodic_fired, tb.order_errors,
+         stats.wakeups_avoided,
+         cpu_usec() - cpu_start, wall_usec() - wall_start,
+         (cpu_usec() - cpu_start) * 1000LL /
+         (tb.oneshot_fired + tb.periodic_fired + 1));
+
+  yp_ml_shutdown();
+  free(tb.deadline);
+}
+
+static void bench_timers_default()
+{
+  bench_timers(5000, 1000, 2000);
+}
+
+/*****************************************************************/
+/* wakeups of an idle phone                                      */
+
+#define BENCH_IDLE_ID      4
+
+static void idle_callback(int id, int group, void *private_data)
+{
+}
+
+static void bench_idle(int duration, int coalescing)
+{
+  struct yp_ml_stats stats;
+  int id;
+
+  yp_ml_init();
+  yp_ml_set_coalescing(coalescing);
+
+  /* the timers of yeaphone while the LED blinks: LED, liblinphone, date */
+  id = yp_ml_schedule_periodic_timer(BENCH_IDLE_ID, 150, 0,
+                                     idle_callback, NULL);
+  yp_ml_set_timer_slack(id, 30);
+  id = yp_ml_schedule_periodic_timer(BENCH_IDLE_ID, 200, 1,
+                                     idle_callback, NULL);
+  yp_ml_set_timer_slack(id, 100);
+  id = yp_ml_schedule_periodic_timer(BENCH_IDLE_ID, 1000, 1,
+                                     idle_callback, NULL);
+  yp_ml_set_timer_slack(id, 250);
+  yp_ml_schedule_timer(BENCH_STOP_ID, duration, stop_callback, NULL);
+
+  yp_ml_run();
+  yp_ml_get_stats(&stats);
+
+  printf("bench=idle coalescing=%d duration_ms=%d wakeups=%llu "
+         "wakeups_per_s=%.2f\n",
+         coalescing, duration, stats.wakeups,
+         stats.wakeups * 1000.0 / duration);
+
+  yp_ml_shutdown();
+}
+
+static void bench_idle_default()
+{
+  bench_idle(2000, 0);
+  bench_idle(2000, 1);
+}
+
+/*****************************************************************/
+/* cross-thread posting                                          */
+
+#ifdef HAVE_PTHREAD_H
+
+#define POST_SEQ_BITS  24     /* task data is (producer << 24) | sequence */
+#define MAX_PRODUCERS  64
+
+struct post_bench {
+  int n_tasks;               /* per producer */
+  int n_producers;
+  long long received;
+  int next_seq[MAX_PRODUCERS];
+  int order_errors;
+};
+
+static struct post_bench pb;
+
+static void post_callback(void *private_data)
+{
+  long val = (long) private_data;
+  int producer = val >> POST_SEQ_BITS;
+  int seq = val & ((1 << POST_SEQ_BITS) - 1);
+
+  if (seq != pb.next_seq[producer])
+    pb.order_errors++;
+  pb.next_seq[producer] = seq + 1;
+  if (++pb.received == (long long) pb.n_tasks * pb.n_producers)
+    yp_ml_stop();
+}
+
+static void *post_producer(void *arg)
+{
+  long producer = (long) arg;
+  int i;
+
+  for (i = 0; i < pb.n_tasks; i++) {
+    while (yp_ml_post(post_callback,
+                      (void *) ((producer << POST_SEQ_BITS) | i)) != 0)
+      usleep(1000);
+  }
+  return NULL;
+}
+
+static void bench_post(int n_producers, int n_tasks)
+{
+  pthread_t threads[MAX_PRODUCERS];
+  long long cpu_start, wall_start;
+  long i;
+
+  if (n_producers > MAX_PRODUCERS)
+    n_producers = MAX_PRODUCERS;
+  if (n_tasks >= (1 << POST_SEQ_BITS))
+    n_tasks = (1 << POST_SEQ_BITS) - 1;
+  memset(&pb, 0, sizeof(pb));
+  pb.n_tasks = n_tasks;
+  pb.n_producers = n_producers;
+
+  yp_ml_init();
+  wall_start = wall_usec();
+  cpu_start = cpu_usec();
+  for (i = 0; i < n_producers; i++)
+    pthread_create(&threads[i], NULL, post_producer, (void *) i);
+
+  yp_ml_run();
+
+  for (i = 0; i < n_producers; i++)
+    pthread_join(threads[i], NULL);
+
+  printf("bench=post producers=%d tasks=%lld received=%lld "
+         "order_errors=%d cpu_us=%lld wall_us=%lld ns_per_task=%lld\n",
+         n_producers, (long long) n_tasks * n_producers, pb.received,
+         pb.order_errors, cpu_usec() - cpu_start, wall_usec() - wall_start,
+         (wall_usec() - wall_start) * 1000LL / (pb.received + 1));
+
+  yp_ml_shutdown();
+}
+
+static void bench_post_default()
+{
+  bench_post(4, 1000000);
+}
+
+/*****************************************************************/
+/* cross-thread wakeup latency                                   */
+
+struct wakeup_bench {
+  long long *sample;
+  int n;
+  int max_samples;
+  volatile int done;
+};
+
+static struct wakeup_bench wb;
+
+static void stop_task(void *private_data)
+{
+  yp_ml_stop();
+}
+
+static void wakeup_task(void *private_data)
+{
+  long long *posted = private_data;
+
+  wb.sample[wb.n] = mono_usec() - *posted;
+  wb.n++;
+  wb.done = 1;
+}
+
+static void *wakeup_thread(void *arg)
+{
+  long long posted;
+  int i;
+
+  for (i = 0; i < wb.max_samples; i++) {
+    /* give the loop time to block before the next post */
+    usleep(500);
+    wb.done = 0;
+    posted = mono_usec();
+    yp_ml_post(wakeup_task, &posted);
+    while (!wb.done)
+      usleep(50);
+  }
+  yp_ml_post(stop_task, NULL);
+  return NULL;
+}
+
+/* Time from yp_ml_post() in another thread until the task runs while
+ * the loop is blocked in the backend.
+ */
+static void bench_wakeup(int samples)
+{
+  pthread_t thread;
+
+  memset(&wb, 0, sizeof(wb));
+  wb.sample = calloc(samples, sizeof(wb.sample[0]));
+  wb.max_samples = samples;
+  yp_ml_init();
+  pthread_create(&thread, NULL, wakeup_thread, NULL);
+  yp_ml_run();
+  pthread_join(thread, NULL);
+
+  printf("bench=wakeup samples=%d", wb.n);
+  print_dist("latency_us", wb.sample, wb.n);
+  printf("\n");
+
+  yp_ml_shutdown();
+  free(wb.sample);
+}
+
+static void bench_wakeup_default()
+{
+  bench_wakeup(1000);
+}
+
+/*****************************************************************/
+/* input latency under display load                              */
+
+struct keylat_bench {
+  int fd[2];
+  long long *sample;
+  int n;
+  int max_samples;
+  int work;                  /* run time of a display callback in [us] */
+};
+
+static struct keylat_bench kb;
+
+static void display_callback(int id, int group, void *private_data)
+{
+  long long end = mono_usec() + kb.work;
+
+  while (mono_usec() < end)
+    ;
+}
+
+static void key_callback(int id, int group, void *private_data)
+{
+  long long pressed;
+
+  if (read(kb.fd[0], &pressed, sizeof(pressed)) != sizeof(pressed))
+    return;
+  if (pressed < 0) {
+    yp_ml_stop();
+    return;
+  }
+  kb.sample[kb.n++] = mono_usec() - pressed;
+}
+
+static void *key_thread(void *arg)
+{
+  unsigned int seed = 1;
+  long long pressed;
+  int i;
+
+  for (i = 0; i <= kb.max_samples; i++) {
+    usleep(1000 + rand_r(&seed) % 4000);
+    pressed = (i < kb.max_samples) ? mono_usec() : -1;
+    if (write(kb.fd[1], &pressed, sizeof(pressed)) != sizeof(pressed))
+      break;
+  }
+  return NULL;
+}
+
+/* Time from a "key press" (a write to a pipe by another thread) until
+ * its io callback runs while bursts of display timers keep the loop busy,
+ * with and without priority classes and a dispatch budget.
+ */
+static void bench_keylat(int n_timers, int work, int use_prio, int budget,
+                         int samples)
+{
+  struct yp_ml_stats stats;
+  pthread_t thread;
+  int i, id;
+
+  memset(&kb, 0, sizeof(kb));
+  kb.sample = calloc(samples, sizeof(kb.sample[0]));
+  kb.max_samples = samples;
+  kb.work = work;
+  if (pipe(kb.fd) < 0) {
+    perror("pipe");
+    exit(1);
+  }
+  yp_ml_init();
+  id = yp_ml_poll_io(BENCH_KEY_ID, kb.fd[0], key_callback, NULL);
+  if (use_prio) {
+    yp_ml_set_priority(id, YP_ML_PRIO_INPUT);
+    yp_ml_set_priority(-1, YP_ML_PRIO_DISPLAY);
+    yp_ml_set_dispatch_budget(budget);
+  }
+  /* the timers expire together, like a redraw of the whole display */
+  for (i = 0; i < n_timers; i++)
+    yp_ml_schedule_periodic_timer(BENCH_DISPLAY_ID, 20, 0,
+                                  display_callback, NULL);
+  pthread_create(&thread, NULL, key_thread, NULL);
+  yp_ml_run();
+  pthread_join(thread, NULL);
+  yp_ml_get_stats(&stats);
+
+  printf("bench=keylat timers=%d work_us=%d priorities=%d budget_ms=%d "
+         "samples=%d postponed=%llu",
+         n_timers, work, use_prio, budget, kb.n, stats.postponed);
+  print_dist("latency_us", kb.sample, kb.n);
+  printf("\n");
+
+  yp_ml_shutdown();
+  close(kb.fd[0]);
+  close(kb.fd[1]);
+  free(kb.sample);
+}
+
+static void bench_keylat_default()
+{
+  bench_keylat(200, 50, 0, 0, 500);
+  bench_keylat(200, 50, 1, 0, 500);
+  bench_keylat(200, 50, 1, 1, 500);
+}
+
+#endif
+
+/*****************************************************************/
+/* control file writes                                           */
+
+#define SYSFS_WRITES      20000
+#define SYSFS_TRACED      1000
+
+static const char *sysfs_files[] = {
+  "line1", "line2", "line3", "show_icon", "hide_icon", "ringtone", "model"
+};
+
+/* How ylsysfs wrote control files before the fds were cached. */
+static int fopen_write_control_file(const char *control, const char *line)
+{
+  const char *path_sysfs = ylsysfs_get_sysfs_path();
+  char path[256];
+  FILE *fp;
+  int res;
+
+  strcpy(path, path_sysfs);
+  strcat(path, control);
+  fp = fopen(path, "wb");
+  if (fp == NULL)
+    return -1;
+  res = fwrite(line, 1, strlen(line), fp);
+  fclose(fp);
+  return res;
+}
+
+/* A typical mix of display updates: the seconds of the date and the
+ * blinking LED. */
+static void sysfs_writes(int cached, int n)
+{
+  static const char *updates[][2] = {
+    { "line1", "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t 7" },
+    { "show_icon", "LED" },
+    { "hide_icon", "LED" }
+  };
+  int i;
+
+  for (i = 0; i < n; i++) {
+    if (cached)
+      ylsysfs_write_control_file(updates[i % 3][0], updates[i % 3][1]);
+    else
+      fopen_write_control_file(updates[i % 3][0], updates[i % 3][1]);
+  }
+}
+
+#ifdef HAVE_SYS_PTRACE_H
+/* Counts the system calls of a child process doing 'n' writes. */
+static long count_syscalls(int cached, int n)
+{
+  long count = 0;
+  int status;
+  pid_t pid;
+
+  fflush(stdout);
+  pid = fork();
+  if (pid == 0) {
+    ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+    raise(SIGSTOP);
+    sysfs_writes(cached, n);
+    _exit(0);
+  }
+  if ((pid < 0) || (waitpid(pid, &status, 0) < 0))
+    return -1;
+  while (1) {
+    /* the child stops on every entry and exit of a system call */
+    if (ptrace(PTRACE_SYSCALL, pid, NULL, NULL) < 0) {
+      kill(pid, SIGKILL);
+      waitpid(pid, &status, 0);
+      return -1;
+    }
+    if ((waitpid(pid, &status, 0) < 0) || WIFEXITED(status) ||
+        WIFSIGNALED(status))
+      break;
+    count++;
+  }
+  return count / 2;
+}
+#endif
+
+/* Writes to control files of a fake sysfs directory, once with an
+ * fopen/fwrite/fclose per write and once through ylsysfs. The number of
+ * system calls per write is counted by tracing a child process.
+ */
+static void bench_sysfs()
+{
+  char dir[] = "/tmp/ypmlbench.XXXXXX";
+  char path[64];
+  long long start, cpu;
+  long syscalls = -1;
+  int i, cached, fd;
+
+  if (mkdtemp(dir) == NULL) {
+    perror("mkdtemp");
+    return;
+  }
+  for (i = 0; i < sizeof(sysfs_files) / sizeof(sysfs_files[0]); i++) {
+    sprintf(path, "%s/%s", dir, sysfs_files[i]);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+      if (!strcmp(sysfs_files[i], "model"))
+        write(fd, "P1K\n", 4);
+      close(fd);
+    }
+  }
+  ylsysfs_set_sysfs_path(dir);
+
+  for (cached = 0; cached <= 1; cached++) {
+#ifdef HAVE_SYS_PTRACE_H
+    syscalls = count_syscalls(cached, SYSFS_TRACED) - count_syscalls(cached, 0);
+#endif
+    start = wall_usec();
+    cpu = cpu_usec();
+    sysfs_writes(cached, SYSFS_WRITES);
+    cpu = cpu_usec() - cpu;
+    printf("bench=sysfs method=%s writes=%d syscalls_per_write=%.2f "
+           "cpu_us=%lld wall_us=%lld ns_per_write=%lld\n",
+           (cached) ? "cached" : "fopen", SYSFS_WRITES,
+           (syscalls >= 0) ? (double) syscalls / SYSFS_TRACED : -1.0,
+           cpu, wall_usec() - start, cpu * 1000LL / SYSFS_WRITES);
+  }
+
+  for (i = 0; i < sizeof(sysfs_files) / sizeof(sysfs_files[0]); i++) {
+    sprintf(path, "%s/%s", dir, sysfs_files[i]);
+    unlink(path);
+  }
+  rmdir(dir);
+}
+
+/*****************************************************************/
+/* key to display latency through a simulated handset            */
+
+struct sim_bench {
+  int fd;
+  int keys;
+  int max_keys;
+  int work;                  /* run time of a load callback in [us] */
+  char text[13];
+  long long pressed;         /* when the last key was injected */
+  long long *sample;         /* until its io callback ran [us] */
+  int n;
+  int redraws;
+};
+
+static struct sim_bench sb;
+
+static void sim_load_callback(int id, int group, void *private_data)
+{
+  long long end = mono_usec() + sb.work;
+
+  while (mono_usec() < end)
+    ;
+}
+
+/* like ylcontrol, a key changes the text line */
+static void sim_io_callback(int id, int group, void *private_data)
+{
+  struct input_event event;
+
+  if (read(sb.fd, &event, sizeof(event)) != sizeof(event))
+    return;
+  if ((event.type == EV_KEY) && event.value) {
+    if (sb.sample)
+      sb.sample[sb.n++] = mono_usec() - sb.pressed;
+    snprintf(sb.text, sizeof(sb.text), "key %8d", sb.keys);
+    set_yldisp_text(sb.text);
+  }
+}
+
+static void sim_key_callback(int id, int group, void *private_data)
+{
+  if (sb.keys++ >= sb.max_keys) {
+    yp_ml_stop();
+    return;
+  }
+  sb.pressed = mono_usec();
+  ylsim_key(KEY_1, 1);
+  ylsim_key(KEY_1, 0);
+}
+
+/* Time from a key event of a simulated handset until the display shows
+ * its effect, ie. through the event device, the mainloop, yldisp and
+ * the control files, while timers keep the loop busy.
+ */
+static void bench_sim(int n_timers, int work, int use_prio, int keys)
+{
+  struct ylsim_stats stats;
+  int i, id;
+
+  memset(&sb, 0, sizeof(sb));
+  sb.max_keys = keys;
+  sb.work = work;
+  yp_ml_init();
+  if (ylsim_start("P1K") < 0)
+    exit(1);
+  sb.fd = open(ylsysfs_get_event_path(), O_RDONLY | O_NONBLOCK);
+  if (sb.fd < 0) {
+    perror(ylsysfs_get_event_path());
+    exit(1);
+  }
+  id = yp_ml_poll_io(BENCH_SIM_IO_ID, sb.fd, sim_io_callback, NULL);
+  if (use_prio) {
+    yp_ml_set_priority(id, YP_ML_PRIO_INPUT);
+    yp_ml_set_priority(-1, YP_ML_PRIO_BACKGROUND);
+    yp_ml_set_dispatch_budget(1);
+  }
+  for (i = 0; i < n_timers; i++)
+    yp_ml_schedule_periodic_timer(BENCH_DISPLAY_ID, 20, 0,
+                                  sim_load_callback, NULL);
+  /* well above the resolution of the timers, so keys do not collapse */
+  yp_ml_schedule_periodic_timer(BENCH_SIM_KEY_ID, 25, 0,
+                                sim_key_callback, NULL);
+  yp_ml_run();
+  ylsim_get_stats(&stats);
+
+  printf("bench=sim timers=%d work_us=%d priorities=%d budget_ms=%d "
+         "keys=%lu "
+         "displayed=%lu latency_us_min=%lu latency_us_avg=%lu "
+         "latency_us_max=%lu\n",
+         n_timers, work, use_prio, use_prio, stats.keys, stats.latencies,
+         stats.latency_min,
+         (stats.latencies) ? stats.latency_sum / stats.latencies : 0,
+         stats.latency_max);
+
+  yldisp_clear();
+  close(sb.fd);
+  ylsim_stop();
+  yp_ml_shutdown();
+}
+
+/* changes something every time, like a blinking display */
+static void redraw_callback(int id, int group, void *private_data)
+{
+  sb.redraws++;
+  set_yldisp_call_type((sb.redraws & 1) ? YL_CALL_IN : YL_CALL_OUT);
+  set_yldisp_store_type((sb.redraws & 2) ? YL_STORE_ON : YL_STORE_NONE);
+}
+
+/* Input and display latency of a simulated handset whose writes block
+ * for 'write_delay' [us] each, with and without the writer thread.
+ */
+static void bench_writer(int use_thread, int write_delay, int keys)
+{
+  struct ylsim_stats stats;
+  struct yldisp_stats disp;
+
+  memset(&sb, 0, sizeof(sb));
+  sb.max_keys = keys;
+  sb.sample = calloc(keys, sizeof(sb.sample[0]));
+  yp_ml_init();
+  if (ylsim_start("P1K") < 0)
+    exit(1);
+  ylsim_set_write_delay(write_delay);
+  sb.fd = open(ylsysfs_get_event_path(), O_RDONLY | O_NONBLOCK);
+  if (sb.fd < 0) {
+    perror(ylsysfs_get_event_path());
+    exit(1);
+  }
+  if (yldisp_set_writer_thread(use_thread) < 0)
+    exit(1);
+  yp_ml_poll_io(BENCH_SIM_IO_ID, sb.fd, sim_io_callback, NULL);
+  yldisp_led_blink(20, 20);
+  yp_ml_schedule_periodic_timer(BENCH_REDRAW_ID, 20, 0,
+                                redraw_callback, NULL);
+  yp_ml_schedule_periodic_timer(BENCH_SIM_KEY_ID, 25, 0,
+                                sim_key_callback, NULL);
+  yp_ml_run();
+  ylsim_get_stats(&stats);
+  yldisp_clear();
+  yldisp_get_stats(&disp);
+
+  printf("bench=writer thread=%d write_delay_us=%d keys=%d", use_thread,
+         write_delay, sb.n);
+  print_dist("input_latency_us", sb.sample, sb.n);
+  printf(" display_latency_us_avg=%lu display_latency_us_max=%lu "
+         "written=%lu merged=%lu queued_max=%lu wait_us_avg=%lu "
+         "wait_us_max=%lu\n",
+         (stats.latencies) ? stats.latency_sum / stats.latencies : 0,
+         stats.latency_max, disp.written, disp.collapsed, disp.queued_max,
+         (disp.written) ? disp.wait_us / disp.written : 0, disp.wait_max_us);
+
+  yldisp_set_writer_thread(0);
+  close(sb.fd);
+  ylsim_stop();
+  yp_ml_shutdown();
+  free(sb.sample);
+}
+
+static void bench_writer_default()
+{
+  bench_writer(0, 3000, 200);
+  bench_writer(1, 3000, 200);
+}
+
+/*****************************************************************/
+/* wakeups of an idle phone showing the date                     */
+
+static unsigned long long settled_wakeups;
+
+static void settled_callback(int id, int group, void *private_data)
+{
+  struct yp_ml_stats stats;
+
+  yp_ml_get_stats(&stats);
+  settled_wakeups = stats.wakeups;
+}
+
+/* The simulated handset shows the date with the LED on, like a phone
+ * which is registered and on-hook. Wakeups are counted for 'duration' [ms]
+ * once the idle mode had time to start. */
+static void bench_dispidle(int idle_timeout, int duration)
+{
+  struct yp_ml_stats stats;
+  struct yldisp_stats disp;
+  int settle = (idle_timeout + 2) * 1000;
+
+  yp_ml_init();
+  if (ylsim_start("P1K") < 0)
+    exit(1);
+  yldisp_set_idle_timeout(idle_timeout);
+  yldisp_show_date();
+  yldisp_led_on();
+  yp_ml_schedule_timer(BENCH_SETTLED_ID, settle, settled_callback, NULL);
+  yp_ml_schedule_timer(BENCH_STOP_ID, settle + duration,
+                       stop_callback, NULL);
+  yp_ml_run();
+  yp_ml_get_stats(&stats);
+  yldisp_get_stats(&disp);
+
+  printf("bench=dispidle idle_timeout_s=%d duration_ms=%d wakeups=%llu "
+         "wakeups_per_min=%.1f idle_ms=%lu\n",
+         idle_timeout, duration, stats.wakeups - settled_wakeups,
+         (stats.wakeups - settled_wakeups) * 60000.0 / duration,
+         disp.idle_ms);
+
+  yldisp_clear();
+  ylsim_stop();
+  yp_ml_shutdown();
+}
+
+static void bench_dispidle_default()
+{
+  bench_dispidle(0, 10000);
+  /* a whole minute, it has a single tick */
+  bench_dispidle(1, 60000);
+}
+
+/*****************************************************************/
+/* call state transitions on the display                         */
+
+struct scene_bench {
+  int use_scenes;
+  int step;
+  int cycles;
+  long long ring_us;         /* spent in the transitions to ringing */
+  unsigned long ring_flushes;
+  unsigned long ring_writes;
+};
+
+static struct scene_bench scb;
+
+/* the sequence of display calls yeaphone made for each state before
+ * there were scenes */
+static void scene_adhoc(yldisp_scene_t scene)
+{
+  switch (scene) {
+    case YLDISP_SCENE_RINGING:
+      set_yldisp_text("0123456789");
+      set_yldisp_call_type(YL_CALL_IN);
+      yldisp_led_blink(300, 300);
+      set_yldisp_backlight(1);
+      set_yldisp_ringer(YL_RINGER_ON, 0);
+      break;
+    case YLDISP_SCENE_IN_CALL:
+      set_yldisp_ringer(YL_RINGER_OFF, 0);
+      yldisp_start_counter();
+      yldisp_led_blink(1000, 100);
+      break;
+    default:
+      set_yldisp_ringer(YL_RINGER_OFF_DELAYED, 0);
+      set_yldisp_call_type(YL_CALL_NONE);
+      set_yldisp_text("  9876543210");
+      yldisp_show_date();
+      yldisp_led_on();
+      set_yldisp_backlight(0);
+      break;
+  }
+}
+
+static void scene_callback(int id, int group, void *private_data)
+{
+  static const yldisp_scene_t cycle[3] = {
+    YLDISP_SCENE_RINGING, YLDISP_SCENE_IN_CALL, YLDISP_SCENE_CALL_END
+  };
+  yldisp_scene_t scene = cycle[scb.step % 3];
+  struct yldisp_stats before, after;
+  long long start;
+
+  yldisp_get_stats(&before);
+  start = mono_usec();
+  if (!scb.use_scenes) {
+    scene_adhoc(scene);
+    /* yldisp_set_scene() writes the changes itself */
+    yldisp_flush();
+  }
+  else {
+    if (scene == YLDISP_SCENE_RINGING)
+      set_yldisp_text("0123456789");
+    else if (scene == YLDISP_SCENE_CALL_END)
+      set_yldisp_text("  9876543210");
+    yldisp_set_scene(scene, 0);
+  }
+  if (scene == YLDISP_SCENE_RINGING) {
+    scb.ring_us += mono_usec() - start;
+    yldisp_get_stats(&after);
+    scb.ring_flushes += after.flushes - before.flushes;
+    scb.ring_writes += after.writes - before.writes;
+  }
+  if (++scb.step == scb.cycles * 3)
+    yp_ml_stop();
+}
+
+/* Runs 'cycles' incoming calls on a simulated P1KH, which has no hold
+ * before ringing, and reports the cost of starting to ring. */
+static void bench_scene(int use_scenes, int cycles)
+{
+  struct yldisp_stats start, disp;
+
+  memset(&scb, 0, sizeof(scb));
+  scb.use_scenes = use_scenes;
+  scb.cycles = cycles;
+  yp_ml_init();
+  if (ylsim_start("P1KH") < 0)
+    exit(1);
+  yldisp_show_date();
+  yldisp_led_on();
+  yldisp_flush();
+  yldisp_get_stats(&start);
+  yp_ml_schedule_periodic_timer(BENCH_SCENE_ID, 30, 0,
+                                scene_callback, NULL);
+  yp_ml_run();
+  yldisp_get_stats(&disp);
+
+  printf("bench=scene scenes=%d transitions=%d flushes=%lu writes=%lu "
+         "ring_us_avg=%.1f ring_flushes=%.2f ring_writes=%.2f\n",
+         use_scenes, scb.step, disp.flushes - start.flushes,
+         disp.writes - start.writes,
+         (double) scb.ring_us / cycles,
+         (double) scb.ring_flushes / cycles,
+         (double) scb.ring_writes / cycles);
+
+  yldisp_clear();
+  ylsim_stop();
+  yp_ml_shutdown();
+}
+
+static void bench_scene_default()
+{
+  bench_scene(0, 50);
+  bench_scene(1, 50);
+}
+
+static void bench_sim_default()
+{
+  bench_sim(0, 0, 0, 200);
+  bench_sim(200, 50, 0, 200);
+  bench_sim(200, 50, 1, 200);
+}
+
+/*****************************************************************/
+
+static void bench_schedule_default()
+{
+  bench_schedule(10000);
+  bench_schedule(60000);    /* close to the maximum number of events */
+}
+
+static void bench_dispatch_default()
+{
+  bench_dispatch(0, 2, 200000);
+  bench_dispatch(1000, 100, 200000);
+  bench_dispatch(10000, 500, 200000);
+}
+
+static void bench_jitter_default()
+{
+  bench_jitter(10, 200);
+}
+
+struct bench_entry {
+  const char *name;
+  void (*run)();
+};
+
+static const struct bench_entry benches[] = {
+  { "schedule", bench_schedule_default },
+  { "dispatch", bench_dispatch_default },
+  { "timers", bench_timers_default },
+  { "jitter", bench_jitter_default },
+  { "idle", bench_idle_default },
+#ifdef HAVE_PTHREAD_H
+  { "post", bench_post_default },
+  { "wakeup", bench_wakeup_default },
+  { "keylat", bench_keylat_default },
+#endif
+  { "sysfs", bench_sysfs },
+  { "sim", bench_sim_default },
+#ifdef HAVE_PTHREAD_H
+  { "writer", bench_writer_default },
+#endif
+  { "dispidle", bench_dispidle_default },
+  { "scene", bench_scene_default },
+  { NULL, NULL }
+};
+
+/*****************************************************************/
+
+int main(int argc, char **argv)
+{
+  int i, j;
+
+  if (argc <= 1) {
+    for (j = 0; benches[j].name; j++)
+      benches[j].run();
+    return 0;
+  }
+  for (i = 1; i < argc; i++) {
+    for (j = 0; benches[j].name; j++) {
+      if (!strcmp(argv[i], benches[j].name))
+        break;
+    }
+    if (!benches[j].name) {
+      fprintf(stderr, "Usage: %s [benchmark ...]\nBenchmarks:", argv[0]);
+      for (j = 0; benches[j].name; j++)
+        fprintf(stderr, " %s", benches[j].name);
+      fprintf(stderr, "\n");
+      return 1;
+    }
+    benches[j].run();
+  }
+
+  return 0;
+}